@@ -1,12 +1,20 @@
 // Noah Rubin
 
 #include <iostream>
+#include <sstream>
 #include <algorithm>
 #include <vector>
 #include <future>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
 
 #include "AI.h"
 #include "Board.h"
+#include "SearchTrace.h"
 
 #define WINNING_VALUE 1000000
 #define LOSING_VALUE -1000000
@@ -41,115 +49,1185 @@
 namespace
 {
 	constexpr int STARTING_DEPTH = 9;
+	constexpr int MAX_HEURISTIC_DEPTH = 13;
+	constexpr int EXACT_SEARCH_MOVE = 8;
 	constexpr int MAX_DEPTH = 27;
-	constexpr int TTABLE_SIZE = 300000; // three hundred thousand
 	constexpr int STARTING_MAX_CACHE_DEPTH = 3;
 	constexpr int MAX_CACHE_DEPTH = 12;
+	constexpr int EVAL_CACHE_BITS = 14;		// 256 KB per thread, small enough to stay in a core's L2 cache
+	constexpr unsigned long long PROOF_NUMBER_NODES = 1 << 20;	// about a second, after which NegaScout takes over
+	constexpr std::size_t PROOF_NUMBER_SIZE_MB = 16;
+	constexpr int EXTENSION_DEPTH = 3;		// forcing moves are extended within this many plies of the horizon
+	constexpr int MAX_EXTENSION = 4;		// plies a line of selective search may reach past the nominal depth
+	constexpr int REDUCTION_DEPTH = 3;		// depth from which late moves are reduced
+	constexpr int REDUCTION_MOVES = 2;		// moves searched to full depth at a node before the rest are reduced
+	constexpr int REDUCTION = 2;			// plies taken off a reduced move
+	constexpr int ASPIRATION_WINDOW = 1;	// half width of the window around a column's score from an earlier search
 	constexpr int moveOrdering[] { 3, 4, 2, 5, 1, 6, 0 };
-	int movesMade = 0;
-	int maxCacheDepth = STARTING_MAX_CACHE_DEPTH;
+	constexpr unsigned long long EVALUATION_VERSION = 1;	// bump whenever scores change meaning so old table snapshots are rejected
+
+
+	// Win and loss scores count plies from the root of the search. The table stores them
+	// relative to the node instead so that entries remain valid from any other root.
+	int ToTableValue(int value, int depth)
+	{
+		if (value >= WINNING_VALUE - 2 * MAX_DEPTH) {
+			return value - depth;
+		}
+		if (value <= LOSING_VALUE + 2 * MAX_DEPTH) {
+			return value + depth;
+		}
+		return value;
+	}
+
+
+	int FromTableValue(int value, int depth)
+	{
+		if (value >= WINNING_VALUE - 2 * MAX_DEPTH) {
+			return value + depth;
+		}
+		if (value <= LOSING_VALUE + 2 * MAX_DEPTH) {
+			return value - depth;
+		}
+		return value;
+	}
+
+
+	unsigned long long TableSignature()
+	{
+		return (EVALUATION_VERSION << 48) ^ ((unsigned long long) MAX_DEPTH << 32) ^ WINNING_VALUE;
+	}
+
+
+	// Returns order with col moved to the front, using buffer if the order has to change
+	const int* PutFirst(const int* order, int col, int (&buffer)[7])
+	{
+		if (col < 0 || order[0] == col) {
+			return order;
+		}
+		buffer[0] = col;
+		for (int i = 0, j = 1; i < Board::WIDTH; ++i) {
+			if (order[i] != col) {
+				buffer[j++] = order[i];
+			}
+		}
+		return buffer;
+	}
+}
+
+
+const int AI::sm_moveOrderings[7][7] {
+	{ 0, 3, 4, 2, 5, 1, 6 },
+	{ 1, 3, 4, 2, 5, 6, 0 },
+	{ 2, 3, 4, 5, 1, 6, 0 },
+	{ 3, 4, 2, 5, 1, 6, 0 },
+	{ 4, 3, 2, 5, 1, 6, 0 },
+	{ 5, 3, 4, 2, 1, 6, 0 },
+	{ 6, 3, 4, 2, 5, 1, 0 },
+};
+
+
+AI::Options::Options() :
+	startingDepth(STARTING_DEPTH),
+	maxHeuristicDepth(MAX_HEURISTIC_DEPTH),
+	exactSearchMove(EXACT_SEARCH_MOVE),
+	startingMaxCacheDepth(STARTING_MAX_CACHE_DEPTH),
+	maxCacheDepth(MAX_CACHE_DEPTH),
+	parallelRoot(true),
+	verbose(true),
+	table(),
+	keepTable(false),
+	tableFile(),
+	deterministic(false),
+	enhancedCutoffs(false),
+	evalCacheBits(EVAL_CACHE_BITS),
+	staticRules(true),
+	selectiveSearch(false),
+	proofNumberMove(-1),
+	proofNumber(),
+	engine(Engine::NEGASCOUT),
+	monteCarlo()
+{
+	proofNumber.sizeMB = PROOF_NUMBER_SIZE_MB;
+	proofNumber.maxNodes = PROOF_NUMBER_NODES;
+}
+
+
+AI::Statistics::Statistics() :
+	nodes(0),
+	seconds(0.0),
+	tableSeconds(0.0),
+	depth(0),
+	score(0),
+	tableBytes(0),
+	tableHugePages(false),
+	tableLoaded(false),
+	evalProbes(0),
+	evalHits(0),
+	proofNodes(0)
+{
+}
+
+
+struct AI::SearchControl
+{
+	SearchControl();
+
+	std::atomic<bool> stop;
+	std::atomic<unsigned long long> nodes;		// updated every POLL_INTERVAL nodes by each thread
+	std::chrono::steady_clock::time_point start;
+	bool ponder;								// leaves the result for AI::Ponder to play or keep
+	std::mutex mutex;							// guards the members below
+	std::condition_variable finished;
+	bool done;
+	int depth;
+	int bestIndex;								// index into moveOrdering of the best root column searched so far
+	int bestScore;
+};
+
+
+// State shared between the thread that ponders and the owner of the AI
+struct AI::PonderControl
+{
+	PonderControl();
+
+	Board board;							// position the opponent is to move in
+	std::vector<int> replies;				// in the order they are searched
+	std::mutex mutex;						// guards the members below
+	bool stop;
+	bool hit;								// the opponent played the reply being searched
+	int currentReply;						// -1 between searches
+	std::shared_ptr<SearchControl> current;
+	bool searched[Board::WIDTH];			// by column, whether the reply has been searched to the end
+	SearchResult results[Board::WIDTH];
+	Statistics statistics[Board::WIDTH];
+};
+
+
+AI::SearchResult::SearchResult() :
+	column(-1),
+	score(0),
+	depth(0),
+	principalVariation(),
+	completed(true)
+{
+}
+
+
+AI::MoveScore::MoveScore() :
+	column(-1),
+	score(0),
+	principalVariation()
+{
+}
+
+
+AI::Progress::Progress() :
+	column(-1),
+	score(0),
+	depth(0),
+	nodes(0),
+	seconds(0.0)
+{
+}
+
+
+AI::SearchOptions::SearchOptions() :
+	progress(),
+	progressInterval(1.0)
+{
+}
+
+
+AI::SearchControl::SearchControl() :
+	stop(false),
+	nodes(0),
+	start(std::chrono::steady_clock::now()),
+	ponder(false),
+	done(false),
+	depth(0),
+	bestIndex(-1),
+	bestScore(0)
+{
+}
+
+
+AI::PonderControl::PonderControl() :
+	board(),
+	replies(),
+	stop(false),
+	hit(false),
+	currentReply(-1),
+	current()
+{
+	std::fill_n(searched, Board::WIDTH, false);
+}
+
+
+AI::SearchHandle::SearchHandle() :
+	m_control(),
+	m_result()
+{
+}
+
+
+void AI::SearchHandle::Stop()
+{
+	if (m_control) {
+		m_control->stop = true;
+	}
+}
+
+
+AI::SearchResult AI::SearchHandle::Wait() const
+{
+	return m_result.get();
+}
+
+
+bool AI::SearchHandle::IsValid() const
+{
+	return m_result.valid();
+}
+
+
+bool AI::SearchHandle::IsReady() const
+{
+	return m_result.valid() && m_result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+
+std::shared_future<AI::SearchResult> AI::SearchHandle::GetFuture() const
+{
+	return m_result;
+}
+
+
+AI::EvaluationCache::EvaluationCache(int bits) :
+	m_slots((std::size_t) 1 << bits),
+	m_shift(64 - bits)
+{
+	// no position has every bit of both boards set, gaps included
+	Slot empty = { ~0ULL, ~0u, 0 };
+	std::fill(m_slots.begin(), m_slots.end(), empty);
+}
+
+
+inline std::size_t AI::EvaluationCache::Index(const Board& board, Board::Bitboard& key, unsigned int& keyHigh) const
+{
+	Board::Bitboard black = board.GetBitboard(CHIP_BLACK);
+	Board::Bitboard red = board.GetBitboard(CHIP_RED);
+	key = black | (red << 48);
+	keyHigh = (unsigned int) (red >> 16);
+	Board::Bitboard hash = (key ^ (keyHigh * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+	return (std::size_t) (hash >> m_shift);
+}
+
+
+inline bool AI::EvaluationCache::Probe(const Board& board, int& score) const
+{
+	Board::Bitboard key;
+	unsigned int keyHigh;
+	const Slot& slot = m_slots[Index(board, key, keyHigh)];
+	if (slot.key != key || slot.keyHigh != keyHigh) {
+		return false;
+	}
+	score = slot.score;
+	return true;
+}
+
+
+inline void AI::EvaluationCache::Store(const Board& board, int score)
+{
+	Board::Bitboard key;
+	unsigned int keyHigh;
+	Slot& slot = m_slots[Index(board, key, keyHigh)];
+	slot.key = key;
+	slot.keyHigh = keyHigh;
+	slot.score = score;
+}
+
+
+AI::ThreadData::ThreadData() :
+	control(nullptr),
+	table(nullptr),
+	sharedTable(nullptr),
+	stopped(false),
+	nodes(0),
+	hint(nullptr),
+	followHint(false),
+	rootMoves(0),
+	evalCache(nullptr),
+	evalProbes(0),
+	evalHits(0)
+{
+	std::fill_n(pvLength, MAX_PLY, 0);
+}
+
+
+void AI::ThreadData::UpdatePrincipalVariation(int ply, int col)
+{
+	pv[ply][ply] = col;
+	int end = std::max(pvLength[ply + 1], ply + 1);
+	for (int i = ply + 1; i < end; ++i) {
+		pv[ply][i] = pv[ply + 1][i];
+	}
+	pvLength[ply] = end;
+}
+
+
+// Returns the move the previous search expected at this ply if the current path has
+// followed its line so far, otherwise -1
+int AI::ThreadData::TakeHint(int ply)
+{
+	bool following = followHint;
+	followHint = false;
+	if (!following || ply >= (int) hint->size()) {
+		return -1;
+	}
+	return (*hint)[ply];
+}
+
+
+// Called every POLL_INTERVAL nodes. Returns true once the search has been asked to stop,
+// after which every node returns immediately without storing anything in the table.
+bool AI::ThreadData::Poll()
+{
+	control->nodes += POLL_INTERVAL;
+	stopped = control->stop;
+	return stopped;
+}
+
+
+bool AI::ThreadData::Probe(const Board& node, TranspositionTable::Entry& entry)
+{
+	return table->Probe(node, entry) || (sharedTable && sharedTable->Probe(node, entry));
+}
+
+
+AI::AI() :
+	AI(Options())
+{
+}
+
+
+AI::AI(const Options& options) :
+	AI(options, nullptr)
+{
+}
+
+
+AI::AI(const Options& options, TranspositionTable& table) :
+	AI(options, &table)
+{
+}
+
+
+AI::AI(const Options& options, TranspositionTable* sharedTable) :
+	m_options(options),
+	m_statistics(),
+	m_ownTable(sharedTable ? nullptr : new TranspositionTable(options.table)),
+	m_transpositionTable(sharedTable ? *sharedTable : *m_ownTable),
+	m_threadTables(),
+	m_evalCaches(),
+	m_prover(options.proofNumberMove >= 0 ? new ProofNumberSearch(options.proofNumber) : nullptr),
+	m_monteCarlo(options.engine == Engine::MONTE_CARLO ? new MonteCarloSearch(options.monteCarlo) : nullptr),
+	m_exactSearch(false),
+	m_searchDepth(options.startingDepth),
+	m_movesMade(0),
+	m_maxCacheDepth(options.startingMaxCacheDepth),
+	m_tableLoaded(false),
+	m_lastResult(),
+	m_lastRoot(),
+	m_ponder(),
+	m_ponderResult()
+{
+	SetMovesMade(0);
+	if (m_options.deterministic) {
+		// the threads no longer share one table, so split its memory between them
+		TranspositionTable::Options tableOptions = options.table;
+		tableOptions.sizeMB = std::max<std::size_t>(1, options.table.sizeMB / Board::WIDTH);
+		tableOptions.initThreads = 1;
+		for (int i = 0; i < Board::WIDTH; ++i) {
+			m_threadTables.emplace_back(new TranspositionTable(tableOptions));
+		}
+	}
+	if (m_options.evalCacheBits > 0) {
+		for (int i = 0; i < Board::WIDTH; ++i) {
+			m_evalCaches.emplace_back(new EvaluationCache(m_options.evalCacheBits));
+		}
+	}
+	if (m_ownTable && !m_options.tableFile.empty()) {
+		m_tableLoaded = LoadTable(m_options.tableFile);
+		if (m_options.verbose) {
+			std::cout << (m_tableLoaded ? "Loaded search results from " : "No usable search results in ") << m_options.tableFile << "\n";
+		}
+	}
+}
+
+
+AI::~AI()
+{
+	StopPondering();
+	if (m_ownTable && !m_options.tableFile.empty()) {
+		SaveTable(m_options.tableFile);
+	}
+}
+
+
+int AI::ThreadFunc(const Board& board, int index, ThreadData& td)
+{
+	SEARCH_TRACE_SCOPE(ROOT_COLUMN, moveOrdering[index]);
+	if (td.control->stop) {
+		td.stopped = true;
+		return 0;
+	}
+	int col = moveOrdering[index];
+	Board child(board);
+	child.Play(col);
+	td.followHint = (!td.hint->empty() && (*td.hint)[0] == col);
+	int score = -SearchRootChild(td, child, LOSING_VALUE - 1, WINNING_VALUE + 1);
+	td.UpdatePrincipalVariation(0, col);
+	if (!td.stopped) {
+		SEARCH_TRACE_LOCK(lock, td.control->mutex, -1);
+		SearchControl& control = *td.control;
+		if (control.bestIndex == -1 || score > control.bestScore || (score == control.bestScore && index < control.bestIndex)) {
+			control.bestIndex = index;
+			control.bestScore = score;
+		}
+	}
+	return score;
+}
+
+
+int AI::BestMove(const Board& board)
+{
+	return Search(board).column;
+}
+
+
+AI::SearchResult AI::Search(const Board& board)
+{
+	SearchHandle pondered = TakePonderedSearch(board);
+	if (pondered.IsValid()) {
+		return pondered.Wait();
+	}
+	SearchControl control;
+	return RunSearch(board, SearchOptions(), control);
+}
+
+
+AI::SearchHandle AI::StartSearch(const Board& board, const SearchOptions& options)
+{
+	SearchHandle handle = TakePonderedSearch(board);
+	if (handle.IsValid()) {
+		return handle;
+	}
+	std::shared_ptr<SearchControl> control = std::make_shared<SearchControl>();
+	handle.m_control = control;
+	handle.m_result = std::async(std::launch::async, [this, board, options, control]()
+	{
+		return RunSearch(board, options, *control);
+	}).share();
+	return handle;
+}
+
+
+AI::SearchResult AI::RunSearch(const Board& board, const SearchOptions& options, SearchControl& control)
+{
+	SEARCH_TRACE_SCOPE(SEARCH, m_searchDepth);
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long proofNodes = 0;
+	int provenCol = FindProvenWin(board, proofNodes);
+	if (provenCol >= 0) {
+		// the prover doesn't say how long the win takes, so it is scored as the longest one
+		m_statistics = Statistics();
+		m_statistics.proofNodes = proofNodes;
+		m_statistics.depth = m_searchDepth;
+		m_statistics.score = WINNING_VALUE - MAX_DEPTH;
+		m_statistics.tableBytes = m_transpositionTable.GetSizeBytes();
+		m_statistics.tableHugePages = m_transpositionTable.HasHugePages();
+		m_statistics.tableLoaded = m_tableLoaded;
+		SearchResult result;
+		result.column = provenCol;
+		result.score = m_statistics.score;
+		result.depth = m_searchDepth;
+		result.principalVariation.push_back(provenCol);
+		if (!control.ponder) {
+			PlayResult(board, result);
+		}
+		m_statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		FinishTables(control.ponder);
+		return result;
+	}
+	if (m_monteCarlo) {
+		control.start = start;
+		return RunMonteCarlo(board, options, control, proofNodes);
+	}
+
+	int scores[7];
+	ThreadData threads[7];
+	std::vector<int> hint = ExpectedLine(board);
+	control.start = start;
+	control.depth = m_searchDepth;
+	for (int i = 0; i < Board::WIDTH; ++i) {
+		threads[i].control = &control;
+		threads[i].hint = &hint;
+		threads[i].rootMoves = board.GetMoveCount();
+		threads[i].evalCache = m_evalCaches.empty() ? nullptr : m_evalCaches[i].get();
+		if (m_options.deterministic) {
+			// each thread writes only its own table and the shared table stays unchanged
+			// until all of them have finished, so no thread sees the timing of another
+			threads[i].table = m_threadTables[i].get();
+			threads[i].sharedTable = &m_transpositionTable;
+		}
+		else {
+			threads[i].table = &m_transpositionTable;
+		}
+	}
+	std::thread monitor;
+	if (options.progress) {
+		monitor = std::thread(&AI::ReportProgress, this, std::cref(options), std::ref(control));
+	}
+
+	std::fill_n(scores, 7, std::numeric_limits<int>::min());
+	if (m_options.parallelRoot) {
+		std::vector<std::future<int>> futures(7);
+		for (int i = 0; i < Board::WIDTH; ++i) {
+			if (!board.IsColumnFull(moveOrdering[i])) {
+				futures[i] = std::async(std::launch::async, &AI::ThreadFunc, this, board, i, std::ref(threads[i]));
+			}
+		}
+		for (int i = 0; i < Board::WIDTH; ++i) {
+			if (!board.IsColumnFull(moveOrdering[i])) {
+				scores[i] = futures[i].get();
+			}
+		}
+	}
+	else {
+		for (int i = 0; i < Board::WIDTH; ++i) {
+			if (!board.IsColumnFull(moveOrdering[i])) {
+				scores[i] = ThreadFunc(board, i, threads[i]);
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(control.mutex);
+		control.done = true;
+	}
+	control.finished.notify_all();
+	if (monitor.joinable()) {
+		monitor.join();
+	}
+
+	bool stopped = false;
+	m_statistics = Statistics();
+	m_statistics.proofNodes = proofNodes;
+	for (int i = 0; i < Board::WIDTH; ++i) {
+		m_statistics.nodes += threads[i].nodes;
+		m_statistics.evalProbes += threads[i].evalProbes;
+		m_statistics.evalHits += threads[i].evalHits;
+		stopped = stopped || threads[i].stopped;
+	}
+	m_statistics.depth = m_searchDepth;
+	m_statistics.tableBytes = m_transpositionTable.GetSizeBytes();
+	m_statistics.tableHugePages = m_transpositionTable.HasHugePages();
+	m_statistics.tableLoaded = m_tableLoaded;
+
+	if (stopped) {
+		// the scores of columns that were cut short are meaningless, so fall back on the
+		// best column that was searched completely and leave the state of the game alone
+		SearchResult result;
+		result.completed = false;
+		result.depth = m_searchDepth;
+		if (control.bestIndex != -1) {
+			result.column = moveOrdering[control.bestIndex];
+			result.score = control.bestScore;
+			result.principalVariation.push_back(result.column);
+		}
+		m_statistics.score = result.score;
+		m_statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		FinishTables(control.ponder);
+		return result;
+	}
+
+	int* ptr = std::max_element(scores, &scores[7]);
+	int max = *ptr;
+	int bestCol = moveOrdering[ptr - scores];
+	ThreadData& bestThread = threads[ptr - scores];
+
+	SearchResult result;
+	result.column = bestCol;
+	result.score = max;
+	result.depth = m_searchDepth;
+	result.principalVariation.assign(bestThread.pv[0], bestThread.pv[0] + bestThread.pvLength[0]);
+	ExtendFromTable(bestThread, board, result.principalVariation);
+	m_statistics.score = max;
+
+	if (!control.ponder) {
+		PlayResult(board, result);
+	}
+	m_statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	FinishTables(control.ponder);
+	return result;
+}
+
+
+// Each column is searched on its own, one after another, so that every search starts from
+// the table the earlier ones left behind. Once count columns have scores, a null window
+// search tells whether the next one beats the worst of them, and only then is it searched
+// exactly, with a window that starts at that score. A column the table already has a score
+// for is searched with a narrow window around it first.
+std::vector<AI::MoveScore> AI::Analyze(const Board& board, int count)
+{
+	auto start = std::chrono::steady_clock::now();
+	count = std::max(1, std::min(count, (int) Board::WIDTH));
+	StopPondering();
+	SearchControl control;
+	std::vector<int> noHint;
+	ThreadData td;
+	td.control = &control;
+	td.hint = &noHint;
+	td.rootMoves = board.GetMoveCount();
+	td.table = &m_transpositionTable;
+	td.evalCache = m_evalCaches.empty() ? nullptr : m_evalCaches[0].get();
+
+	std::vector<MoveScore> best;
+	TranspositionTable::Entry entry;
+	for (int col : moveOrdering) {
+		if (board.IsColumnFull(col)) {
+			continue;
+		}
+		SEARCH_TRACE_SCOPE(ANALYZE_COLUMN, col);
+		Board child(board);
+		child.Play(col);
+		int floor = LOSING_VALUE - 1;
+		if ((int) best.size() == count) {
+			floor = best.back().score;
+			if (-SearchRootChild(td, child, -floor - 1, -floor) <= floor) {
+				continue;
+			}
+		}
+		MoveScore move;
+		move.column = col;
+		if (m_transpositionTable.Probe(child, entry) && entry.solved == IsExactSearch()) {
+			int guess = -FromTableValue(entry.value, m_searchDepth - 1);
+			move.score = AspirationSearch(td, child, std::max(guess, floor + 1), floor);
+		}
+		else {
+			move.score = -SearchRootChild(td, child, LOSING_VALUE - 1, -floor);
+		}
+		td.UpdatePrincipalVariation(0, col);
+		move.principalVariation.assign(td.pv[0], td.pv[0] + td.pvLength[0]);
+		ExtendFromTable(td, board, move.principalVariation);
+
+		auto position = std::find_if(best.begin(), best.end(), [&move](const MoveScore& other) { return other.score < move.score; });
+		best.insert(position, std::move(move));
+		if ((int) best.size() > count) {
+			best.pop_back();
+		}
+	}
+
+	m_statistics = Statistics();
+	m_statistics.nodes = td.nodes;
+	m_statistics.evalProbes = td.evalProbes;
+	m_statistics.evalHits = td.evalHits;
+	m_statistics.depth = m_searchDepth;
+	m_statistics.score = best.empty() ? 0 : best.front().score;
+	m_statistics.tableBytes = m_transpositionTable.GetSizeBytes();
+	m_statistics.tableHugePages = m_transpositionTable.HasHugePages();
+	m_statistics.tableLoaded = m_tableLoaded;
+	m_statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	FinishTables(false);
+	return best;
+}
+
+
+// Returns the exact score of moving to child, which is known to be above floor. The first
+// window is narrow around guess, and the side the score falls outside of is then opened up
+// all the way, which measured cheaper than widening it step by step.
+int AI::AspirationSearch(ThreadData& td, const Board& child, int guess, int floor)
+{
+	int alpha = std::max(floor, guess - ASPIRATION_WINDOW);
+	int beta = std::min(WINNING_VALUE + 1, guess + ASPIRATION_WINDOW);
+	while (true) {
+		int score = -SearchRootChild(td, child, -beta, -alpha);
+		if (score <= alpha && alpha > floor) {
+			beta = score + 1;
+			alpha = floor;
+		}
+		else if (score >= beta && beta <= WINNING_VALUE) {
+			alpha = score - 1;
+			beta = WINNING_VALUE + 1;
+		}
+		else {
+			return score;
+		}
+	}
+}
+
+
+// Returns a winning column if the proof-number search finds a forced win within its node
+// budget, otherwise -1
+int AI::FindProvenWin(const Board& board, unsigned long long& nodes)
+{
+	if (!m_prover || m_movesMade < m_options.proofNumberMove) {
+		return -1;
+	}
+	SEARCH_TRACE_SCOPE(PROOF, -1);
+	unsigned long long before = m_prover->GetNodes();
+	int col = -1;
+	if (m_prover->Prove(board, board.GetThisTurn()) == ProofNumberSearch::Result::PROVEN) {
+		col = m_prover->GetWinningMove(board);
+	}
+	nodes = m_prover->GetNodes() - before;
+	return col;
+}
+
+
+AI::SearchResult AI::RunMonteCarlo(const Board& board, const SearchOptions& options, SearchControl& control, unsigned long long proofNodes)
+{
+	std::thread monitor;
+	if (options.progress) {
+		monitor = std::thread(&AI::ReportProgress, this, std::cref(options), std::ref(control));
+	}
+	MonteCarloSearch::Result found = m_monteCarlo->Search(board, control.stop);
+	{
+		std::lock_guard<std::mutex> lock(control.mutex);
+		control.done = true;
+	}
+	control.finished.notify_all();
+	if (monitor.joinable()) {
+		monitor.join();
+	}
+
+	SearchResult result;
+	result.column = found.column;
+	result.score = found.score;
+	result.depth = (int) found.principalVariation.size();
+	result.principalVariation = found.principalVariation;
+	result.completed = !control.stop;
+	m_statistics = Statistics();
+	m_statistics.nodes = found.simulations;
+	m_statistics.proofNodes = proofNodes;
+	m_statistics.depth = result.depth;
+	m_statistics.score = result.score;
+	if (result.completed && !control.ponder) {
+		// a stopped search still has a move, but like the other engine leaves the game alone
+		PlayResult(board, result);
+	}
+	m_statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - control.start).count();
+	return result;
+}
+
+
+void AI::StartPondering(const Board& board)
+{
+	StopPondering();
+	std::shared_ptr<PonderControl> ponder = std::make_shared<PonderControl>();
+	ponder->board = board;
+	std::vector<int> expected = ExpectedLine(board);
+	int buffer[7];
+	const int* order = PutFirst(moveOrdering, expected.empty() ? -1 : expected[0], buffer);
+	for (int i = 0; i < Board::WIDTH; ++i) {
+		// replies that end the game leave nothing to search
+		Board child(board);
+		if (!child.IsColumnFull(order[i]) && !child.Play(order[i]) && !child.IsBoardFull()) {
+			ponder->replies.push_back(order[i]);
+		}
+	}
+	if (board.GetWinner() != CHIP_NONE || ponder->replies.empty()) {
+		return;
+	}
+	m_ponder = ponder;
+	m_ponderResult = std::async(std::launch::async, [this, ponder]()
+	{
+		return Ponder(*ponder);
+	}).share();
+}
+
+
+void AI::StopPondering()
+{
+	if (!m_ponder) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_ponder->mutex);
+		m_ponder->stop = true;
+		if (m_ponder->current) {
+			m_ponder->current->stop = true;
+		}
+	}
+	m_ponderResult.wait();
+	m_ponder.reset();
+	m_ponderResult = std::shared_future<SearchResult>();
+}
+
+
+// Runs on its own thread. The state of the game doesn't change until the opponent's move
+// is known, so every reply is searched as the AI's next move would be, and the result is
+// only played once that reply turns out to be the opponent's move.
+AI::SearchResult AI::Ponder(PonderControl& ponder)
+{
+	for (int col : ponder.replies) {
+		SEARCH_TRACE_SCOPE(PONDER, col);
+		std::shared_ptr<SearchControl> control = std::make_shared<SearchControl>();
+		control->ponder = true;
+		{
+			std::lock_guard<std::mutex> lock(ponder.mutex);
+			if (ponder.stop) {
+				break;
+			}
+			ponder.currentReply = col;
+			ponder.current = control;
+		}
+		Board child(ponder.board);
+		child.Drop(col);
+		SearchResult result = RunSearch(child, SearchOptions(), *control);
+		std::lock_guard<std::mutex> lock(ponder.mutex);
+		ponder.currentReply = -1;
+		ponder.current.reset();
+		if (ponder.hit) {
+			if (result.completed) {
+				PlayResult(child, result);
+				FinishTables(false);
+			}
+			return result;
+		}
+		if (!result.completed) {
+			break;
+		}
+		ponder.searched[col] = true;
+		ponder.results[col] = result;
+		ponder.statistics[col] = m_statistics;
+	}
+	return SearchResult();
+}
+
+
+// If the opponent's move led to board and it is being pondered, returns a handle to the
+// search that carries on, or if it has already been searched, to its result. Otherwise
+// stops pondering and returns an invalid handle.
+AI::SearchHandle AI::TakePonderedSearch(const Board& board)
+{
+	SearchHandle handle;
+	std::shared_ptr<PonderControl> ponder = m_ponder;
+	if (!ponder) {
+		return handle;
+	}
+	int reply = -1;
+	for (int col = 0; col < Board::WIDTH; ++col) {
+		Board child(ponder->board);
+		if (!child.IsColumnFull(col)) {
+			child.Drop(col);
+			if (child == board) {
+				reply = col;
+			}
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(ponder->mutex);
+		if (reply >= 0 && reply == ponder->currentReply) {
+			ponder->hit = true;
+			handle.m_control = ponder->current;
+			handle.m_result = m_ponderResult;
+			m_ponder.reset();
+			m_ponderResult = std::shared_future<SearchResult>();
+			return handle;
+		}
+	}
+	StopPondering();
+	if (reply >= 0 && ponder->searched[reply]) {
+		m_statistics = ponder->statistics[reply];
+		PlayResult(board, ponder->results[reply]);
+		FinishTables(false);
+		std::promise<SearchResult> finished;
+		finished.set_value(ponder->results[reply]);
+		handle.m_control = std::make_shared<SearchControl>();
+		handle.m_result = finished.get_future().share();
+	}
+	return handle;
+}
+
+
+// Makes result the AI's move on board, which moves the AI on to its next phase of the game
+void AI::PlayResult(const Board& board, const SearchResult& result)
+{
+	m_lastResult = result;
+	m_lastRoot = board;
+	SetMovesMade(m_movesMade + 1);
+	if (m_options.verbose) {
+		if (result.score >= WINNING_VALUE - MAX_DEPTH) {
+			std::cout << "Winning moves for AI found\n";	// the AI is now guaranteed to win
+		}
+		else if (result.score <= LOSING_VALUE + MAX_DEPTH) {
+			std::cout << "Winning moves for opponent found\n";	// if the opponent plays perfectly, he will win
+		}
+	}
+}
+
+
+void AI::ReportProgress(const SearchOptions& options, SearchControl& control) const
+{
+	auto interval = std::chrono::duration<double>(options.progressInterval);
+	std::unique_lock<std::mutex> lock(control.mutex);
+	while (!control.finished.wait_for(lock, interval, [&control]() { return control.done; })) {
+		Progress progress;
+		if (m_monteCarlo) {
+			MonteCarloSearch::Result found = m_monteCarlo->GetProgress();
+			progress.column = found.column;
+			progress.score = found.score;
+			progress.depth = (int) found.principalVariation.size();
+			progress.nodes = found.simulations;
+		}
+		else {
+			progress.column = (control.bestIndex == -1 ? -1 : moveOrdering[control.bestIndex]);
+			progress.score = control.bestScore;
+			progress.depth = control.depth;
+			progress.nodes = control.nodes;
+		}
+		progress.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - control.start).count();
+		lock.unlock();
+		options.progress(progress);
+		lock.lock();
+	}
+}
+
+
+void AI::Reset()
+{
+	StopPondering();
+	SetMovesMade(0);
+	if (!KeepsTable()) {
+		m_transpositionTable.Clear();
+		if (m_prover) {
+			m_prover->Clear();
+		}
+		if (m_monteCarlo) {
+			m_monteCarlo->Clear();
+		}
+	}
+	m_lastResult = SearchResult();
+	m_lastRoot = Board();
 }
 
 
-const int AI::sm_moveOrderings[7][7] {
-	{ 0, 3, 4, 2, 5, 1, 6 },
-	{ 1, 3, 4, 2, 5, 6, 0 },
-	{ 2, 3, 4, 5, 1, 6, 0 },
-	{ 3, 4, 2, 5, 1, 6, 0 },
-	{ 4, 3, 2, 5, 1, 6, 0 },
-	{ 5, 3, 4, 2, 1, 6, 0 },
-	{ 6, 3, 4, 2, 5, 1, 0 },
-};
+// The search deepens by two plies every second move until it reaches the maximum
+// heuristic depth, and searches to the end of the game from exactSearchMove on.
+void AI::SetMovesMade(int movesMade)
+{
+	m_movesMade = movesMade;
+	if (movesMade >= m_options.exactSearchMove) {
+		BeginExactSearch();
+		return;
+	}
+	m_exactSearch = false;
+	m_maxCacheDepth = m_options.startingMaxCacheDepth;
+	m_searchDepth = m_options.startingDepth;
+	for (int move = 2; move <= movesMade && m_searchDepth < m_options.maxHeuristicDepth; move += 2) {
+		m_searchDepth += 2;
+	}
+}
 
 
-AI::AI() :
-	m_transpositionTable(),
-	m_ttMutex(),
-	m_searchDepth(STARTING_DEPTH),
-	m_evalFunc(&AI::HeuristicEvaluate)
+const AI::Options& AI::GetOptions() const
 {
-	m_transpositionTable.reserve(TTABLE_SIZE);
+	return m_options;
 }
 
 
-int AI::ThreadFunc(const Board& board, int col)
+const AI::Statistics& AI::GetStatistics() const
 {
-	Board child(board);
-	child.Drop(col);
-	return -NegaScoutCache(child, m_searchDepth - 1, LOSING_VALUE - 1, WINNING_VALUE + 1);
+	return m_statistics;
 }
 
 
-int AI::BestMove(const Board& board)
+const AI::SearchResult& AI::GetLastResult() const
 {
-	int scores[7];
-	std::fill_n(scores, 7, std::numeric_limits<int>::min());
-	std::vector<std::future<int>> futures(7);
-	for (int i = 0; i < Board::WIDTH; ++i) {
-		if (!board.IsColumnFull(moveOrdering[i])) {
-			futures[i] = std::async(std::launch::async, &AI::ThreadFunc, this, board, moveOrdering[i]);
+	return m_lastResult;
+}
+
+
+bool AI::SaveTable(const std::string& path) const
+{
+	return m_transpositionTable.Save(path, TableSignature());
+}
+
+
+bool AI::LoadTable(const std::string& path)
+{
+	return m_transpositionTable.Load(path, TableSignature());
+}
+
+
+void AI::BeginExactSearch()
+{
+	m_searchDepth = MAX_DEPTH;
+	m_exactSearch = true;
+	m_maxCacheDepth = m_options.maxCacheDepth;
+}
+
+
+bool AI::IsExactSearch() const
+{
+	return m_exactSearch;
+}
+
+
+bool AI::KeepsTable() const
+{
+	return m_options.keepTable || !m_options.tableFile.empty() || !m_ownTable;
+}
+
+
+// Called at the end of every search, after its time is taken, and times itself separately.
+// The thread tables are merged in a fixed order so that the shared table ends up the same on
+// every run. A ponder search keeps everything it found for the search of the AI's move that
+// follows it, whatever the opponent plays.
+void AI::FinishTables(bool pondering)
+{
+	SEARCH_TRACE_SCOPE(TABLE_FLUSH, -1);
+	auto start = std::chrono::steady_clock::now();
+	for (std::unique_ptr<TranspositionTable>& table : m_threadTables) {
+		if (KeepsTable() || pondering) {
+			m_transpositionTable.Merge(*table);
 		}
+		table->Clear();
 	}
-	for (int i = 0; i < Board::WIDTH; ++i) {
-		if (!board.IsColumnFull(moveOrdering[i])) {
-			scores[i] = futures[i].get();
+	if (!KeepsTable() && !pondering) {
+		m_transpositionTable.Clear();
+	}
+	m_statistics.tableSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// If board lies on the line the last search expected, returns the rest of that line
+// from board onwards, usually starting two plies in after the opponent's expected reply
+std::vector<int> AI::ExpectedLine(const Board& board) const
+{
+	const std::vector<int>& pv = m_lastResult.principalVariation;
+	Board expected(m_lastRoot);
+	for (std::size_t i = 0; i < pv.size(); ++i) {
+		if (expected == board) {
+			return std::vector<int>(pv.begin() + i, pv.end());
 		}
+		expected.Drop(pv[i]);
 	}
-	int* ptr = std::max_element(scores, &scores[7]);
-	int max = *ptr;
-	int bestCol = moveOrdering[ptr - scores];
-	if (++movesMade == 8) {
-		m_searchDepth = MAX_DEPTH;
-		m_evalFunc = &AI::FastEvaluate;
-		maxCacheDepth = MAX_CACHE_DEPTH;
+	return std::vector<int>();
+}
+
+
+// Cutoffs from the table leave the line in the triangular table short, so continue it
+// from the best moves stored in the table while they are exact values or lower bounds
+void AI::ExtendFromTable(ThreadData& td, const Board& board, std::vector<int>& line)
+{
+	Board node(board);
+	for (int col : line) {
+		node.Drop(col);
 	}
-	if (m_searchDepth < 13 && movesMade % 2 == 0) {
-		m_searchDepth += 2;
+	TranspositionTable::Entry entry;
+	while ((int) line.size() < MAX_PLY - 1 && node.GetWinner() == CHIP_NONE && !node.IsBoardFull()) {
+		if (!td.Probe(node, entry) || entry.type == ABResultType::UPPER_BOUND || node.IsColumnFull(entry.bestCol)) {
+			break;
+		}
+		node.Drop(entry.bestCol);
+		line.push_back(entry.bestCol);
 	}
-	if (max >= WINNING_VALUE - MAX_DEPTH) {
-		std::cout << "Winning moves for AI found\n";	// the AI is now guaranteed to win
+}
+
+
+struct AI::ExactEvaluation
+{
+	static constexpr bool EXACT = true;
+
+	static int Evaluate(const AI& ai, ThreadData& td, const Board& node, int depth)
+	{
+		return ai.FastEvaluate(td, node, depth);
 	}
-	else if (max <= LOSING_VALUE + MAX_DEPTH) {
-		std::cout << "Winning moves for opponent found\n";	// if the opponent plays perfectly, he will win
+};
+
+
+struct AI::HeuristicEvaluation
+{
+	static constexpr bool EXACT = false;
+
+	static int Evaluate(const AI& ai, ThreadData& td, const Board& node, int depth)
+	{
+		return ai.HeuristicEvaluate(td, node, depth);
 	}
-	m_transpositionTable.clear();
-	return bestCol;
-}
+};
 
-void AI::Reset()
+
+// Searches a child of the root with the evaluation of the current phase of the game
+int AI::SearchRootChild(ThreadData& td, const Board& child, int alpha, int beta)
 {
-	m_evalFunc = &AI::HeuristicEvaluate;
-	movesMade = 0;
-	m_searchDepth = STARTING_DEPTH;
-	m_transpositionTable.clear();
-	maxCacheDepth = STARTING_MAX_CACHE_DEPTH;
+	if (IsExactSearch()) {
+		return NegaScoutCache<ExactEvaluation>(td, child, m_searchDepth - 1, alpha, beta);
+	}
+	return NegaScoutCache<HeuristicEvaluation>(td, child, m_searchDepth - 1, alpha, beta);
 }
 
 
-int AI::NegaScout(const Board& node, int depth, int alpha, int beta)
+// Selective search changes the depth from move to move, so the ply is counted from the chips
+// on the board, and win and loss scores from the depth a full width search would have here
+template<class Evaluation>
+int AI::NegaScout(ThreadData& td, const Board& node, int depth, int alpha, int beta)
 {
-	if (depth == 0 || node.GetWinner() != CHIP_NONE || node.IsBoardFull()) {
-		return (this->*m_evalFunc)(node, depth);
+	if ((++td.nodes & (POLL_INTERVAL - 1)) == 0 && td.Poll()) {
+		return 0;
+	}
+	int ply = node.GetMoveCount() - td.rootMoves;
+	int hintCol = td.TakeHint(ply);
+	td.pvLength[ply] = ply;
+	if (depth <= 0 || node.GetWinner() != CHIP_NONE || node.IsBoardFull()) {
+		return Evaluation::Evaluate(*this, td, node, m_searchDepth - ply);
+	}
+	int value;
+	if (TakeImmediateWin(td, node, ply, value)) {
+		return value;
+	}
+	if (m_options.staticRules && alpha >= 0 && Evaluation::EXACT && node.IsWinRefuted()) {
+		return 0;	// a draw at best, and the window only cares whether it's better than one
 	}
+	if (depth == 1 && !Evaluation::EXACT) {
+		return NegaScoutFrontier(td, node, ply, hintCol, alpha, beta);
+	}
+	int orderBuffer[7];
+	const int* thisMoveOrder = PutFirst(moveOrdering, hintCol, orderBuffer);
+	Board::Bitboard forced = GetForcedMoves(node);
+	int moveNumber = 0;
 	int m = LOSING_VALUE - 1;
 	int n = beta;
 	int t;
 	int col;
 	for (int i = 0; i < Board::WIDTH; ++i) {
-		col = moveOrdering[i];
+		col = thisMoveOrder[i];
 		if (node.IsColumnFull(col)) {
 			continue;
 		}
 		Board child(node);
-		child.Drop(col);
-		t = -NegaScout(child, depth - 1, -n, -std::max(alpha, m));
+		child.Play(col);
+		td.followHint = (col == hintCol);
+		int childDepth = ChildDepth(node, child, col, depth, ply, moveNumber++, forced);
+		t = (childDepth == 0 ? -EvaluateLeaf<Evaluation>(td, child, ply + 1) : -NegaScout<Evaluation>(td, child, childDepth, -n, -std::max(alpha, m)));
+		if (childDepth < depth - 1 && t > std::max(alpha, m)) {
+			childDepth = depth - 1;
+			t = -NegaScout<Evaluation>(td, child, childDepth, -n, -std::max(alpha, m));
+		}
 		if (t > m) {
-			if (n == beta || t >= beta) {
+			// a leaf's value doesn't depend on the window, so it never needs searching again
+			if (n == beta || t >= beta || childDepth == 0) {
 				m = t;
 			}
 			else {
-				m = -NegaScout(child, depth - 1, -beta, -t);
+				m = -NegaScout<Evaluation>(td, child, childDepth, -beta, -t);
 			}
+			td.UpdatePrincipalVariation(ply, col);
+		}
+		if (td.stopped) {
+			return 0;
 		}
 		if (m >= beta) {
 			return m;
@@ -160,60 +1238,101 @@ int AI::NegaScout(const Board& node, int depth, int alpha, int beta)
 }
 
 
-int AI::NegaScoutCache(const Board& node, int depth, int alpha, int beta)
+template<class Evaluation>
+int AI::NegaScoutCache(ThreadData& td, const Board& node, int depth, int alpha, int beta)
 {
+	if ((++td.nodes & (POLL_INTERVAL - 1)) == 0 && td.Poll()) {
+		return 0;
+	}
+	int ply = node.GetMoveCount() - td.rootMoves;
+	int hintCol = td.TakeHint(ply);
+	td.pvLength[ply] = ply;
 	const int* thisMoveOrder = sm_moveOrderings[3];
-	const int* moveOrder = sm_moveOrderings[3];
+	int orderBuffer[7];
 	int m = LOSING_VALUE - 1;
 	int n = beta;
 	int t;
 	int col;
-	{
-		std::lock_guard<std::mutex> lock(m_ttMutex);
-		auto it = m_transpositionTable.find(node);
-		if (it != m_transpositionTable.end()) {
-			switch (it->second.type) {
+	TranspositionTable::Entry entry;
+	if (td.Probe(node, entry)) {
+		if (entry.depth >= depth && entry.solved == Evaluation::EXACT) {
+			int value = FromTableValue(entry.value, m_searchDepth - ply);
+			switch (entry.type) {
 			case ABResultType::EXACT:
-				return it->second.value;
+				return value;
 			case ABResultType::LOWER_BOUND:
-				m = std::max(m, it->second.value);
+				m = std::max(m, value);
 				break;
 			case ABResultType::UPPER_BOUND:
-				n = std::min(beta, it->second.value);
+				n = std::min(beta, value);
 				break;
 			}
 			if (m >= beta) {
-				return it->second.value;
+				return value;
 			}
-			thisMoveOrder = it->second.moveOrder;
 		}
+		thisMoveOrder = sm_moveOrderings[entry.bestCol];
 	}
-	if (depth == 0 || node.GetWinner() != CHIP_NONE || node.IsBoardFull()) {
-		return (this->*m_evalFunc)(node, depth);
+	if (depth <= 0 || node.GetWinner() != CHIP_NONE || node.IsBoardFull()) {
+		return Evaluation::Evaluate(*this, td, node, m_searchDepth - ply);
+	}
+	int value;
+	if (TakeImmediateWin(td, node, ply, value)) {
+		return value;
+	}
+	if (m_options.staticRules && alpha >= 0 && Evaluation::EXACT && node.IsWinRefuted()) {
+		return 0;
+	}
+	if (m_options.enhancedCutoffs && depth > m_maxCacheDepth) {
+		if (FindTranspositionCutoff(td, node, depth, beta, thisMoveOrder, value, col)) {
+			entry.type = ABResultType::LOWER_BOUND;
+			entry.value = ToTableValue(value, m_searchDepth - ply);
+			entry.depth = depth;
+			entry.bestCol = col;
+			entry.solved = Evaluation::EXACT;
+			td.table->Store(node, entry);
+			td.pvLength[ply + 1] = ply + 1;
+			td.UpdatePrincipalVariation(ply, col);
+			return value;
+		}
 	}
 
 	int best = m;
+	int bestCol = 3;
 
+	thisMoveOrder = PutFirst(thisMoveOrder, hintCol, orderBuffer);
+	Board::Bitboard forced = GetForcedMoves(node);
+	int moveNumber = 0;
 	for (int i = 0; i < Board::WIDTH; ++i) {
 		col = thisMoveOrder[i];
 		if (node.IsColumnFull(col)) {
 			continue;
 		}
 		Board child(node);
-		child.Drop(col);
-		t = (depth <= maxCacheDepth ? -NegaScout(child, depth - 1, -n, -std::max(alpha, m)) : -NegaScoutCache(child, depth - 1, -n, -std::max(alpha, m)));
+		child.Play(col);
+		td.followHint = (col == hintCol);
+		int childDepth = ChildDepth(node, child, col, depth, ply, moveNumber++, forced);
+		t = (depth <= m_maxCacheDepth ? -NegaScout<Evaluation>(td, child, childDepth, -n, -std::max(alpha, m)) : -NegaScoutCache<Evaluation>(td, child, childDepth, -n, -std::max(alpha, m)));
+		if (childDepth < depth - 1 && t > std::max(alpha, m)) {
+			childDepth = depth - 1;
+			t = (depth <= m_maxCacheDepth ? -NegaScout<Evaluation>(td, child, childDepth, -n, -std::max(alpha, m)) : -NegaScoutCache<Evaluation>(td, child, childDepth, -n, -std::max(alpha, m)));
+		}
 		if (t > m) {
 			if (n == beta || t >= beta) {
 				m = t;
 			}
 			else {
-				m = (depth <= maxCacheDepth ? -NegaScout(child, depth - 1, -beta, -t) : -NegaScoutCache(child, depth - 1, -beta, -t));
+				m = (depth <= m_maxCacheDepth ? -NegaScout<Evaluation>(td, child, childDepth, -beta, -t) : -NegaScoutCache<Evaluation>(td, child, childDepth, -beta, -t));
 			}
 		}
+		if (td.stopped) {
+			return 0;
+		}
 
 		if (m > best) {
 			best = m;
-			moveOrder = sm_moveOrderings[col];
+			bestCol = col;
+			td.UpdatePrincipalVariation(ply, col);
 		}
 
 		if (m >= beta) {
@@ -221,22 +1340,202 @@ int AI::NegaScoutCache(const Board& node, int depth, int alpha, int beta)
 		}
 		n = std::max(alpha, m) + 1;
 	}
-	m_ttMutex.lock();
+	entry.value = ToTableValue(m, m_searchDepth - ply);
+	entry.depth = depth;
+	entry.bestCol = bestCol;
+	entry.solved = Evaluation::EXACT;
 	if (m <= alpha) {
-		m_transpositionTable.insert({ node, { ABResultType::UPPER_BOUND, m, moveOrder } });
+		entry.type = ABResultType::UPPER_BOUND;
 	}
 	else if (m >= beta) {
-		m_transpositionTable.insert({ node, { ABResultType::LOWER_BOUND, m, moveOrder } });
+		entry.type = ABResultType::LOWER_BOUND;
 	}
 	else {
-		m_transpositionTable.insert({ node, { ABResultType::EXACT, m, moveOrder } });
+		entry.type = ABResultType::EXACT;
+	}
+	td.table->Store(node, entry);
+	return m;
+}
+
+
+// What searching a child at depth 0 returns, without the rest of the work done at a node.
+// Every child of a node one ply above the horizon goes through here.
+template<class Evaluation>
+inline int AI::EvaluateLeaf(ThreadData& td, const Board& leaf, int ply)
+{
+	if ((++td.nodes & (POLL_INTERVAL - 1)) == 0 && td.Poll()) {
+		return 0;
+	}
+	td.followHint = false;
+	td.pvLength[ply] = ply;
+	return Evaluation::Evaluate(*this, td, leaf, m_searchDepth - ply);
+}
+
+
+// The loop of NegaScout one ply above the horizon in the heuristic phase, where nearly every
+// child is a leaf. The children are built and checked for wins and threats together, and
+// their heuristic scores are worked out a few at a time, so that a cutoff early in the
+// move order wastes at most Board::LANES - 1 of them. Nodes, cache statistics and results
+// are those of the loop in NegaScout.
+int AI::NegaScoutFrontier(ThreadData& td, const Board& node, int ply, int hintCol, int alpha, int beta)
+{
+	int orderBuffer[7];
+	const int* thisMoveOrder = PutFirst(moveOrdering, hintCol, orderBuffer);
+	Frontier frontier;
+	frontier.numChildren = node.PlayAll(thisMoveOrder, frontier.children, frontier.columns, frontier.won, frontier.threats);
+	frontier.numScored = 0;
+	Board::Bitboard forced = GetForcedMoves(node);
+	int m = LOSING_VALUE - 1;
+	int n = beta;
+	for (int i = 0; i < frontier.numChildren; ++i) {
+		int col = frontier.columns[i];
+		td.followHint = (col == hintCol);
+		int childDepth = ChildDepth(frontier.threats[i], col, 1, ply, i, forced);
+		int t = (childDepth == 0 ? -EvaluateFrontierLeaf(td, frontier, i, ply + 1) : -NegaScout<HeuristicEvaluation>(td, frontier.children[i], childDepth, -n, -std::max(alpha, m)));
+		if (t > m) {
+			if (n == beta || t >= beta || childDepth == 0) {
+				m = t;
+			}
+			else {
+				m = -NegaScout<HeuristicEvaluation>(td, frontier.children[i], childDepth, -beta, -t);
+			}
+			td.UpdatePrincipalVariation(ply, col);
+		}
+		if (td.stopped) {
+			return 0;
+		}
+		if (m >= beta) {
+			return m;
+		}
+		n = std::max(alpha, m) + 1;
 	}
-	m_ttMutex.unlock();
 	return m;
 }
 
 
-int AI::FastEvaluate(const Board& node, int depth) const
+// EvaluateLeaf and HeuristicEvaluate for child index of frontier
+int AI::EvaluateFrontierLeaf(ThreadData& td, Frontier& frontier, int index, int ply)
+{
+	if ((++td.nodes & (POLL_INTERVAL - 1)) == 0 && td.Poll()) {
+		return 0;
+	}
+	td.followHint = false;
+	td.pvLength[ply] = ply;
+	if (frontier.won[index]) {
+		return LOSING_VALUE + MAX_DEPTH - (m_searchDepth - ply);
+	}
+	const Board& leaf = frontier.children[index];
+	int score;
+	if (td.evalCache) {
+		++td.evalProbes;
+		if (td.evalCache->Probe(leaf, score)) {
+			++td.evalHits;
+			return score;
+		}
+	}
+	if (index >= frontier.numScored) {
+		int num = std::min((int) Board::LANES, frontier.numChildren - index);
+		Board::WeightedOpenThreeInARows(frontier.children + index, num, frontier.scores + index);
+		frontier.numScored = index + num;
+	}
+	score = frontier.scores[index];
+	if (td.evalCache) {
+		td.evalCache->Store(leaf, score);
+	}
+	return score;
+}
+
+
+// Enhanced transposition cutoff: looks up every child in the table before any of them is
+// searched. If a child's stored upper bound already proves that moving there scores at
+// least beta, the node fails high without searching anything.
+bool AI::FindTranspositionCutoff(ThreadData& td, const Board& node, int depth, int beta, const int* order, int& value, int& col)
+{
+	TranspositionTable::Entry entry;
+	int childPly = node.GetMoveCount() + 1 - td.rootMoves;
+	for (int i = 0; i < Board::WIDTH; ++i) {
+		col = order[i];
+		if (node.IsColumnFull(col)) {
+			continue;
+		}
+		Board child(node);
+		child.Play(col);
+		if (!td.Probe(child, entry) || entry.depth < depth - 1 || entry.solved != IsExactSearch() || entry.type == ABResultType::LOWER_BOUND) {
+			continue;
+		}
+		value = -FromTableValue(entry.value, m_searchDepth - childPly);
+		if (value >= beta) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// A player who can win at once does, and no score is better than that one, so there is no
+// need to look at the other moves
+bool AI::TakeImmediateWin(ThreadData& td, const Board& node, int ply, int& value) const
+{
+	Board::Bitboard wins = node.GetThreats(node.GetThisTurn()) & node.GetPlayableMoves();
+	if (!wins) {
+		return false;
+	}
+	int col = 0;
+	while (!(wins & (Board::Bitboard(0x010101010101ULL) << col))) {
+		++col;
+	}
+	td.pvLength[ply + 1] = ply + 1;
+	td.UpdatePrincipalVariation(ply, col);
+	value = WINNING_VALUE - MAX_DEPTH + m_searchDepth - ply - 1;
+	return true;
+}
+
+
+// Cells the player to move has to play in because the opponent wins there next, or 0 when
+// selective search is off. Selective search only runs in the heuristic phase, where the
+// depth is too low to see every forcing line to its end.
+Board::Bitboard AI::GetForcedMoves(const Board& node) const
+{
+	if (!m_options.selectiveSearch || IsExactSearch()) {
+		return 0;
+	}
+	return node.GetThreats(node.GetNextTurn()) & node.GetPlayableMoves();
+}
+
+
+// Depth to search the move to child to. Near the horizon a forced block, or a move that
+// leaves the opponent two cells to block at once, costs no depth, as long as the line stays
+// within MAX_EXTENSION plies of the nominal depth. A quiet move late in the move order, one
+// that neither blocks nor threatens to win next move, loses a ply, and the caller searches
+// it again to full depth if it turns out better than the moves before it.
+int AI::ChildDepth(const Board& node, const Board& child, int col, int depth, int ply, int moveNumber, Board::Bitboard forced) const
+{
+	if (!m_options.selectiveSearch || IsExactSearch()) {
+		return depth - 1;
+	}
+	return ChildDepth(child.GetThreats(node.GetThisTurn()) & child.GetPlayableMoves(), col, depth, ply, moveNumber, forced);
+}
+
+
+// The same, given the cells the move leaves the player who made it to win in next
+int AI::ChildDepth(Board::Bitboard threats, int col, int depth, int ply, int moveNumber, Board::Bitboard forced) const
+{
+	if (!m_options.selectiveSearch || IsExactSearch()) {
+		return depth - 1;
+	}
+	bool blocks = forced && !(forced & (forced - 1)) && (forced & (Board::Bitboard(0x010101010101ULL) << col));
+	bool doubleThreat = (threats & (threats - 1)) != 0;
+	if ((blocks || doubleThreat) && depth <= EXTENSION_DEPTH && ply + depth < m_searchDepth + MAX_EXTENSION) {
+		return depth;
+	}
+	if (depth >= REDUCTION_DEPTH && moveNumber >= REDUCTION_MOVES && !forced && !threats) {
+		return depth - 1 - REDUCTION;
+	}
+	return depth - 1;
+}
+
+
+int AI::FastEvaluate(ThreadData&, const Board& node, int depth) const
 {
 	if (node.GetWinner() == node.GetThisTurn()) {
 		return WINNING_VALUE - MAX_DEPTH + depth;
@@ -248,7 +1547,7 @@ int AI::FastEvaluate(const Board& node, int depth) const
 }
 
 
-int AI::HeuristicEvaluate(const Board& node, int depth) const
+int AI::HeuristicEvaluate(ThreadData& td, const Board& node, int depth) const
 {
 	if (node.GetWinner() == node.GetThisTurn()) {
 		return WINNING_VALUE - MAX_DEPTH + depth;
@@ -256,7 +1555,179 @@ int AI::HeuristicEvaluate(const Board& node, int depth) const
 	else if (node.GetWinner() == node.GetNextTurn()) {
 		return LOSING_VALUE + MAX_DEPTH - depth;
 	}
-	return node.WeightedOpenThreeInARows(node.GetThisTurn());
+	int score;
+	if (td.evalCache) {
+		++td.evalProbes;
+		if (td.evalCache->Probe(node, score)) {
+			++td.evalHits;
+			return score;
+		}
+	}
+	score = node.WeightedOpenThreeInARows(node.GetThisTurn());
+	if (td.evalCache) {
+		td.evalCache->Store(node, score);
+	}
+	return score;
+}
+
+
+namespace
+{
+	// Reads all of value into number, which is left alone if value isn't a number of its
+	// type or is out of its range
+	template<class T>
+	bool ParseNumber(const std::string& value, T& number)
+	{
+		if (std::is_unsigned<T>::value && value.find('-') != std::string::npos) {
+			return false;
+		}
+		std::istringstream stream(value);
+		T parsed;
+		if (!(stream >> parsed) || !stream.eof()) {
+			return false;
+		}
+		number = parsed;
+		return true;
+	}
+}
+
+
+bool ParseOptions(const std::string& spec, AI::Options& options)
+{
+	std::istringstream stream(spec);
+	std::string pair;
+	while (std::getline(stream, pair, ',')) {
+		if (pair.empty()) {
+			continue;
+		}
+		std::size_t equals = pair.find('=');
+		if (equals == std::string::npos) {
+			return false;
+		}
+		std::string key = pair.substr(0, equals);
+		std::string value = pair.substr(equals + 1);
+		bool valid = true;
+		if (key == "depth") {
+			valid = ParseNumber(value, options.startingDepth);
+		}
+		else if (key == "maxdepth") {
+			valid = ParseNumber(value, options.maxHeuristicDepth);
+		}
+		else if (key == "exact") {
+			valid = ParseNumber(value, options.exactSearchMove);
+		}
+		else if (key == "cache") {
+			valid = ParseNumber(value, options.startingMaxCacheDepth);
+		}
+		else if (key == "endcache") {
+			valid = ParseNumber(value, options.maxCacheDepth);
+		}
+		else if (key == "root") {
+			options.parallelRoot = (value == "parallel");
+		}
+		else if (key == "verbose") {
+			options.verbose = (value != "0");
+		}
+		else if (key == "keep") {
+			options.keepTable = (value != "0");
+		}
+		else if (key == "etc") {
+			options.enhancedCutoffs = (value != "0");
+		}
+		else if (key == "rules") {
+			options.staticRules = (value != "0");
+		}
+		else if (key == "selective") {
+			options.selectiveSearch = (value != "0");
+		}
+		else if (key == "pns") {
+			valid = ParseNumber(value, options.proofNumberMove);
+		}
+		else if (key == "pnsnodes") {
+			valid = ParseNumber(value, options.proofNumber.maxNodes);
+		}
+		else if (key == "pnstt") {
+			valid = ParseNumber(value, options.proofNumber.sizeMB);
+		}
+		else if (key == "engine") {
+			if (value == "negascout") {
+				options.engine = AI::Engine::NEGASCOUT;
+			}
+			else if (value == "mcts") {
+				options.engine = AI::Engine::MONTE_CARLO;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (key == "mctstime") {
+			valid = ParseNumber(value, options.monteCarlo.seconds);
+		}
+		else if (key == "mctsthreads") {
+			valid = ParseNumber(value, options.monteCarlo.threads);
+		}
+		else if (key == "mctsmb") {
+			valid = ParseNumber(value, options.monteCarlo.sizeMB);
+		}
+		else if (key == "rollouts") {
+			if (value == "random") {
+				options.monteCarlo.threatRollouts = false;
+			}
+			else if (value == "threats") {
+				options.monteCarlo.threatRollouts = true;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (key == "evalcache") {
+			valid = ParseNumber(value, options.evalCacheBits);
+		}
+		else if (key == "deterministic") {
+			options.deterministic = (value != "0");
+		}
+		else if (key == "ttfile") {
+			options.tableFile = value;
+		}
+		else if (key == "tt") {
+			valid = ParseNumber(value, options.table.sizeMB);
+		}
+		else if (key == "pages") {
+			if (value == "normal") {
+				options.table.pages = TranspositionTable::PagePolicy::NORMAL;
+			}
+			else if (value == "advise") {
+				options.table.pages = TranspositionTable::PagePolicy::ADVISE_HUGE;
+			}
+			else if (value == "reserve") {
+				options.table.pages = TranspositionTable::PagePolicy::RESERVE_HUGE;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (key == "numa") {
+			if (value == "none") {
+				options.table.numa = TranspositionTable::NumaPolicy::NONE;
+			}
+			else if (value == "interleave") {
+				options.table.numa = TranspositionTable::NumaPolicy::INTERLEAVE;
+			}
+			else if (value == "firsttouch") {
+				options.table.numa = TranspositionTable::NumaPolicy::FIRST_TOUCH;
+			}
+			else {
+				return false;
+			}
+		}
+		else {
+			return false;
+		}
+		if (!valid) {
+			return false;
+		}
+	}
+	return true;
 }
 
 /*
@@ -3,51 +3,352 @@
 #ifndef AI_H_INCLUDED
 #define AI_H_INCLUDED
 
-#include <unordered_map>
-#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <functional>
 
 #include "Build.h"
 #include "Board.h"
+#include "MonteCarloSearch.h"
+#include "ProofNumberSearch.h"
+#include "TranspositionTable.h"
 
 
 class AI
 {
 public:
+	enum class Engine
+	{
+		NEGASCOUT,			// fixed depth heuristic search, then exact search from exactSearchMove on
+		MONTE_CARLO,		// Monte Carlo tree search within a time budget for every move, scores run from -1000 to 1000
+	};
+
+	// Configuration of the search. The defaults reproduce the original engine.
+	struct Options
+	{
+		Options();
+
+		int startingDepth;			// search depth of the first move
+		int maxHeuristicDepth;		// depth stops increasing at this value
+		int exactSearchMove;		// number of AI moves after which the game tree is searched to the end
+		int startingMaxCacheDepth;	// nodes at or below this depth skip the transposition table
+		int maxCacheDepth;			// same as above once the exact search starts
+		bool parallelRoot;			// search each root column on its own thread
+		bool verbose;				// print when a forced win is found
+		TranspositionTable::Options table;
+		bool keepTable;				// keep search results between moves and games instead of clearing them
+		std::string tableFile;		// snapshot loaded at startup and saved at shutdown, implies keepTable
+		bool deterministic;			// give each root column a private table so node counts and moves are reproducible
+		bool enhancedCutoffs;		// look up every child in the table before searching any of them (ETC)
+		int evalCacheBits;			// log2 of the number of heuristic scores each search thread caches, 0 for none
+		bool staticRules;			// cut off exact search nodes the side to move provably can't win (Board::IsWinRefuted)
+		bool selectiveSearch;		// in the heuristic phase extend forced moves and reduce quiet ones late in the move order
+		int proofNumberMove;		// number of AI moves after which a proof-number search looks for a forced win first, -1 for never
+		ProofNumberSearch::Options proofNumber;
+		Engine engine;
+		MonteCarloSearch::Options monteCarlo;
+	};
+
+	// Counters describing the most recent search
+	struct Statistics
+	{
+		Statistics();
+
+		unsigned long long nodes;
+		double seconds;
+		double tableSeconds;		// merging and clearing the tables after the search, not part of seconds
+		int depth;
+		int score;
+		std::size_t tableBytes;
+		bool tableHugePages;		// whether the transposition table is backed by huge pages
+		bool tableLoaded;			// whether the table started from a snapshot file
+		unsigned long long evalProbes;	// heuristic leaves looked up in the evaluation caches
+		unsigned long long evalHits;	// of which were found there
+		unsigned long long proofNodes;	// nodes expanded by the proof-number search, which are not counted in nodes
+	};
+
+	// Outcome of a search: the chosen column, its score and the expected line of play
+	// starting with that column
+	struct SearchResult
+	{
+		SearchResult();
+
+		int column;
+		int score;
+		int depth;
+		std::vector<int> principalVariation;
+		bool completed;				// false if the search was stopped, column is then the best found so far or -1
+	};
+
+	// Score of one column in an analysis
+	struct MoveScore
+	{
+		MoveScore();
+
+		int column;
+		int score;
+		std::vector<int> principalVariation;	// expected line of play starting with column
+	};
+
+	// Snapshot of a running search passed to progress callbacks
+	struct Progress
+	{
+		Progress();
+
+		int column;					// best root column among those searched so far, -1 before the first one finishes
+		int score;
+		int depth;
+		unsigned long long nodes;
+		double seconds;
+	};
+
+	struct SearchOptions
+	{
+		SearchOptions();
+
+		std::function<void(const Progress&)> progress;	// called from a separate thread while the search runs
+		double progressInterval;						// seconds between calls to progress
+	};
+
+	struct SearchControl;		// state shared by the threads of one search and its handle, defined in AI.cpp
+
+	// Handle to a search running in the background. Only one search may run on an AI at a
+	// time, and the AI must not be reset or destroyed until the search has finished.
+	class SearchHandle
+	{
+	public:
+		SearchHandle();
+
+		// Asks the search to finish as soon as possible. A stopped search leaves the move
+		// counter and search depth of the AI unchanged.
+		void Stop();
+
+		SearchResult Wait() const;
+
+		bool IsValid() const;
+
+		bool IsReady() const;
+
+		std::shared_future<SearchResult> GetFuture() const;
+
+	private:
+		friend class AI;
+
+		std::shared_ptr<SearchControl> m_control;
+		std::shared_future<SearchResult> m_result;
+	};
+
 	AI();
 
+	explicit AI(const Options& options);
+
+	// Searches with table instead of a table of its own, so that several AIs can share what
+	// they find. The table must outlive the AI, which never clears it or loads and saves
+	// options.tableFile.
+	AI(const Options& options, TranspositionTable& table);
+
+	~AI();
+
 	int BestMove(const Board& board);
 
+	SearchResult Search(const Board& board);
+
+	SearchHandle StartSearch(const Board& board, const SearchOptions& options = SearchOptions());
+
+	// Searches on the opponent's time once the AI has moved on board: first the position
+	// after the reply the last search expected, then those after the other replies in move
+	// ordering order. A Search or StartSearch from one of them carries on with its search or
+	// returns its result, and any other position stops pondering and searches with the table
+	// the ponder searches filled. A search that began as pondering reports no progress.
+	void StartPondering(const Board& board);
+
+	void StopPondering();
+
+	// Exact scores of the count best columns for the player to move, best first, searched
+	// to the depth the next move would be. Leaves the move counter alone, so it can be
+	// called on any position of the game in progress.
+	std::vector<MoveScore> Analyze(const Board& board, int count = Board::WIDTH);
+
 	void Reset();
 
+	// Puts the AI in the phase of the game it would be in after movesMade moves of its own,
+	// for searching positions that don't come from one game played in order.
+	void SetMovesMade(int movesMade);
+
+	bool SaveTable(const std::string& path) const;
+
+	bool LoadTable(const std::string& path);
+
+	const Options& GetOptions() const;
+
+	const Statistics& GetStatistics() const;
+
+	const SearchResult& GetLastResult() const;
+
 private:
-	enum class ABResultType
+	typedef TranspositionTable::BoundType ABResultType;
+
+	struct ThreadData;
+
+	struct PonderControl;		// defined in AI.cpp
+
+	// Leaf evaluations the search is compiled for, one per phase of the game, so that the
+	// evaluation is inlined into the search instead of called through a pointer
+	struct ExactEvaluation;
+	struct HeuristicEvaluation;
+
+	static constexpr int MAX_PLY = Board::WIDTH * Board::HEIGHT + 1;
+	static constexpr unsigned long long POLL_INTERVAL = 1 << 14;	// nodes searched between checks for a stop request
+
+	// Direct mapped cache of heuristic scores. Leaves below the table's cache depth are
+	// reached again and again through transpositions, and their scores only depend on the
+	// position, so they stay valid for the life of the AI. A new position replaces
+	// whatever was in its slot.
+	class EvaluationCache
 	{
-		EXACT, LOWER_BOUND, UPPER_BOUND
+	public:
+		explicit EvaluationCache(int bits);
+
+		bool Probe(const Board& board, int& score) const;
+
+		void Store(const Board& board, int score);
+
+	private:
+		struct Slot
+		{
+			Board::Bitboard key;
+			unsigned int keyHigh;
+			int score;
+		};
+
+		std::vector<Slot> m_slots;
+		int m_shift;
+
+		std::size_t Index(const Board& board, Board::Bitboard& key, unsigned int& keyHigh) const;
 	};
 
-	typedef int (AI::*EvaluationFunction)(const Board&, int) const;
+	// State owned by a single search thread
+	struct ThreadData
+	{
+		ThreadData();
+
+		void UpdatePrincipalVariation(int ply, int col);
+
+		int TakeHint(int ply);
+
+		bool Poll();
 
-	struct TTData
+		bool Probe(const Board& node, TranspositionTable::Entry& entry);
+
+		SearchControl* control;
+		TranspositionTable* table;			// table written by this thread
+		TranspositionTable* sharedTable;	// read only table consulted when table misses, in deterministic mode
+		bool stopped;
+		unsigned long long nodes;
+		int pv[MAX_PLY][MAX_PLY];		// triangular table, row p holds the best line found from ply p
+		int pvLength[MAX_PLY];			// end of each row of pv
+		const std::vector<int>* hint;	// line expected by the previous search, tried first while the search stays on it
+		bool followHint;
+		int rootMoves;					// chips on the board at the root, the ply of a node is counted from it
+		EvaluationCache* evalCache;		// null when disabled
+		unsigned long long evalProbes;
+		unsigned long long evalHits;
+	};
+
+	// The children of a node one ply above the horizon in move order, built together by
+	// Board::PlayAll. The heuristic scores the leaves among them Board::LANES at a time,
+	// from the first one the search needs that isn't cached.
+	struct Frontier
 	{
-		ABResultType type;
-		int value;
-		const int* moveOrder;
+		Board children[Board::WIDTH];
+		int columns[Board::WIDTH];
+		bool won[Board::WIDTH];
+		Board::Bitboard threats[Board::WIDTH];		// cells each move leaves the player who made it to win in next
+		int scores[Board::WIDTH];
+		int numChildren;
+		int numScored;								// children scored so far, from the first
 	};
 
-	std::unordered_map<Board, TTData> m_transpositionTable;
-	std::mutex m_ttMutex;
-	EvaluationFunction m_evalFunc;
+	Options m_options;
+	Statistics m_statistics;
+	std::unique_ptr<TranspositionTable> m_ownTable;		// null when the table is shared
+	TranspositionTable& m_transpositionTable;
+	std::vector<std::unique_ptr<TranspositionTable>> m_threadTables;	// one per root column in deterministic mode
+	std::vector<std::unique_ptr<EvaluationCache>> m_evalCaches;			// one per root column
+	std::unique_ptr<ProofNumberSearch> m_prover;						// null when proofNumberMove is -1
+	std::unique_ptr<MonteCarloSearch> m_monteCarlo;						// null unless it is the engine
+	bool m_exactSearch;
 	int m_searchDepth;
+	int m_movesMade;
+	int m_maxCacheDepth;
+	bool m_tableLoaded;
+	SearchResult m_lastResult;
+	Board m_lastRoot;
+	std::shared_ptr<PonderControl> m_ponder;		// null when not pondering
+	std::shared_future<SearchResult> m_ponderResult;	// result of the ponder search the opponent's move hit
+
+	AI(const Options& options, TranspositionTable* sharedTable);
+
+	int SearchRootChild(ThreadData& td, const Board& child, int alpha, int beta);
+
+	template<class Evaluation>
+	int NegaScout(ThreadData& td, const Board& node, int depth, int alpha, int beta);
 
-	int NegaScout(const Board& node, int depth, int alpha, int beta);
+	template<class Evaluation>
+	int NegaScoutCache(ThreadData& td, const Board& node, int depth, int alpha, int beta);
 
-	int NegaScoutCache(const Board& node, int depth, int alpha, int beta);
+	template<class Evaluation>
+	int EvaluateLeaf(ThreadData& td, const Board& leaf, int ply);
 
-	int ThreadFunc(const Board& board, int col);
+	int NegaScoutFrontier(ThreadData& td, const Board& node, int ply, int hintCol, int alpha, int beta);
 
-	int FastEvaluate(const Board& node, int depth) const;
+	int EvaluateFrontierLeaf(ThreadData& td, Frontier& frontier, int index, int ply);
 
-	int HeuristicEvaluate(const Board& node, int depth) const;
+	int ThreadFunc(const Board& board, int index, ThreadData& td);
+
+	bool FindTranspositionCutoff(ThreadData& td, const Board& node, int depth, int beta, const int* order, int& value, int& col);
+
+	bool TakeImmediateWin(ThreadData& td, const Board& node, int ply, int& value) const;
+
+	Board::Bitboard GetForcedMoves(const Board& node) const;
+
+	int ChildDepth(const Board& node, const Board& child, int col, int depth, int ply, int moveNumber, Board::Bitboard forced) const;
+
+	int ChildDepth(Board::Bitboard threats, int col, int depth, int ply, int moveNumber, Board::Bitboard forced) const;
+
+	SearchResult RunSearch(const Board& board, const SearchOptions& options, SearchControl& control);
+
+	int FindProvenWin(const Board& board, unsigned long long& nodes);
+
+	int AspirationSearch(ThreadData& td, const Board& child, int guess, int floor);
+
+	SearchResult RunMonteCarlo(const Board& board, const SearchOptions& options, SearchControl& control, unsigned long long proofNodes);
+
+	void ReportProgress(const SearchOptions& options, SearchControl& control) const;
+
+	SearchResult Ponder(PonderControl& ponder);
+
+	SearchHandle TakePonderedSearch(const Board& board);
+
+	void PlayResult(const Board& board, const SearchResult& result);
+
+	void BeginExactSearch();
+
+	std::vector<int> ExpectedLine(const Board& board) const;
+
+	void ExtendFromTable(ThreadData& td, const Board& board, std::vector<int>& line);
+
+	bool IsExactSearch() const;
+
+	bool KeepsTable() const;
+
+	void FinishTables(bool pondering);
+
+	int FastEvaluate(ThreadData& td, const Board& node, int depth) const;
+
+	int HeuristicEvaluate(ThreadData& td, const Board& node, int depth) const;
 
 	static const int sm_moveOrderings[7][7];
 	
@@ -68,4 +369,9 @@ private:
 */
 };
 
+
+// Parses a comma separated list of key=value pairs, such as "depth=7,exact=10,root=serial",
+// into options. Returns false and leaves the options partially updated on an unknown key.
+bool ParseOptions(const std::string& spec, AI::Options& options);
+
 #endif
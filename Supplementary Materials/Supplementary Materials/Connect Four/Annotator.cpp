@@ -0,0 +1,258 @@
+// Noah Rubin
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include "AI.h"
+#include "Board.h"
+#include "GameRecord.h"
+#include "TranspositionTable.h"
+
+/*
+	Scores every position of every game in a game record (see GameRecord.h), for example to
+	label a large collection of games. Games are spread across a pool of worker threads with
+	an engine each, and all of the engines share one transposition table for the whole run,
+	so positions that several games pass through are mostly answered from the table.
+
+	The output is a CSV file with one row per move, in the same order as the record:
+
+		game,ply,move,score,best,depth
+
+	score is the engine's value of the position before the move for the player making it,
+	best is the column the engine would have played and depth is the depth it searched to.
+	Columns are written 1-7. Each position is searched with the depth the engine would use
+	at that point of a game it played itself, so OPTIONS work as they do in Tournament. The
+	table is sized by tt=MB; ttfile is ignored. Games with an illegal move are scored up
+	to that move.
+
+	-import turns a text file with one game per line, written as columns 1-7, into a record.
+
+	Usage:
+		Annotator -in FILE [-out FILE] [-options OPTIONS] [-threads T]
+		Annotator -import TEXT -in FILE
+*/
+
+
+namespace
+{
+	struct Settings
+	{
+		std::string inFile;
+		std::string outFile = "annotations.csv";
+		std::string importFile;
+		AI::Options options;
+		unsigned int threads = 0;
+	};
+
+
+	// Reads games from the record on behalf of all of the workers and writes their results
+	// back in record order
+	class Annotation
+	{
+	public:
+		Annotation(GameRecordReader& reader, std::ostream& out) :
+			m_reader(reader),
+			m_out(out),
+			m_nextRead(0),
+			m_nextWrite(0),
+			m_positions(0),
+			m_illegalGames(0)
+		{
+		}
+
+		bool NextGame(unsigned long long& index, std::vector<int>& moves)
+		{
+			std::lock_guard<std::mutex> lock(m_readMutex);
+			if (!m_reader.Next(moves)) {
+				return false;
+			}
+			index = m_nextRead++;
+			return true;
+		}
+
+		// rows holds the output of game index. Games are buffered until every game before
+		// them has been written.
+		void FinishGame(unsigned long long index, std::string&& rows, int positions, bool legal)
+		{
+			std::lock_guard<std::mutex> lock(m_writeMutex);
+			m_positions += positions;
+			m_illegalGames += legal ? 0 : 1;
+			m_pending.emplace(index, std::move(rows));
+			for (auto it = m_pending.begin(); it != m_pending.end() && it->first == m_nextWrite; it = m_pending.erase(it)) {
+				m_out << it->second;
+				++m_nextWrite;
+			}
+		}
+
+		unsigned long long GetGames() const { return m_nextWrite; }
+
+		unsigned long long GetPositions() const { return m_positions; }
+
+		unsigned long long GetIllegalGames() const { return m_illegalGames; }
+
+	private:
+		GameRecordReader& m_reader;
+		std::ostream& m_out;
+		std::mutex m_readMutex;
+		std::mutex m_writeMutex;
+		std::map<unsigned long long, std::string> m_pending;
+		unsigned long long m_nextRead;
+		unsigned long long m_nextWrite;
+		unsigned long long m_positions;
+		unsigned long long m_illegalGames;
+	};
+
+
+	void AnnotateGames(Annotation& annotation, const AI::Options& options, TranspositionTable& table)
+	{
+		AI engine(options, table);
+		unsigned long long index;
+		std::vector<int> moves;
+		while (annotation.NextGame(index, moves)) {
+			std::ostringstream rows;
+			Board board;
+			engine.Reset();
+			int ply = 0;
+			for (; ply < (int) moves.size(); ++ply) {
+				int col = moves[ply];
+				if (col >= Board::WIDTH || board.IsColumnFull(col) || board.GetWinner() != CHIP_NONE) {
+					break;
+				}
+				engine.SetMovesMade(ply / 2);
+				AI::SearchResult result = engine.Search(board);
+				rows << index << "," << ply << "," << col + 1 << "," << result.score << ","
+					<< result.column + 1 << "," << result.depth << "\n";
+				board.Drop(col);
+			}
+			annotation.FinishGame(index, rows.str(), ply, ply == (int) moves.size());
+		}
+	}
+
+
+	int ImportGames(const Settings& settings)
+	{
+		std::ifstream text(settings.importFile);
+		if (!text) {
+			std::cerr << "Can't read " << settings.importFile << "\n";
+			return 1;
+		}
+		GameRecordWriter writer(settings.inFile);
+		std::string line;
+		std::vector<int> moves;
+		unsigned long long skipped = 0;
+		while (std::getline(text, line)) {
+			moves.clear();
+			for (char c : line) {
+				if (c >= '1' && c <= '7') {
+					moves.push_back(c - '1');
+				}
+			}
+			if (!writer.Add(moves)) {
+				++skipped;
+			}
+		}
+		unsigned long long games = writer.GetNumGames();
+		if (!writer.Close()) {
+			std::cerr << "Can't write " << settings.inFile << "\n";
+			return 1;
+		}
+		std::cout << "games " << games << " written to " << settings.inFile << ", skipped " << skipped << "\n";
+		return 0;
+	}
+
+
+	bool ParseArguments(int argc, char** argv, Settings& settings)
+	{
+		settings.options.parallelRoot = false;
+		settings.options.verbose = false;
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (i + 1 >= argc) {
+				return false;
+			}
+			std::string value = argv[++i];
+			if (arg == "-in") {
+				settings.inFile = value;
+			}
+			else if (arg == "-out") {
+				settings.outFile = value;
+			}
+			else if (arg == "-import") {
+				settings.importFile = value;
+			}
+			else if (arg == "-options") {
+				if (!ParseOptions(value, settings.options)) {
+					std::cerr << "Invalid engine options: " << value << "\n";
+					return false;
+				}
+			}
+			else if (arg == "-threads") {
+				settings.threads = (unsigned int) std::atoi(value.c_str());
+			}
+			else {
+				return false;
+			}
+		}
+		return !settings.inFile.empty();
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!ParseArguments(argc, argv, settings)) {
+		std::cerr << "Usage: Annotator -in FILE [-out FILE] [-options OPTIONS] [-threads T]\n"
+			"       Annotator -import TEXT -in FILE\n";
+		return 1;
+	}
+	if (!settings.importFile.empty()) {
+		return ImportGames(settings);
+	}
+
+	GameRecordReader reader(settings.inFile);
+	if (!reader.IsOpen()) {
+		std::cerr << "Not a game record: " << settings.inFile << "\n";
+		return 1;
+	}
+	std::ofstream out(settings.outFile);
+	if (!out) {
+		std::cerr << "Can't write " << settings.outFile << "\n";
+		return 1;
+	}
+	out << "game,ply,move,score,best,depth\n";
+
+	unsigned int numThreads = settings.threads;
+	if (numThreads == 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	TranspositionTable table(settings.options.table);
+	settings.options.tableFile.clear();
+	Annotation annotation(reader, out);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < numThreads; ++t) {
+		workers.emplace_back(AnnotateGames, std::ref(annotation), std::cref(settings.options), std::ref(table));
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "games " << annotation.GetGames() << " of " << reader.GetNumGames()
+		<< ", positions " << annotation.GetPositions() << " in " << seconds << " s\n";
+	if (annotation.GetIllegalGames() > 0) {
+		std::cout << "games with an illegal move " << annotation.GetIllegalGames() << "\n";
+	}
+	return annotation.GetGames() == reader.GetNumGames() ? 0 : 1;
+}
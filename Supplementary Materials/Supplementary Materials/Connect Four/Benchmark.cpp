@@ -0,0 +1,445 @@
+// Noah Rubin
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include "AI.h"
+#include "Board.h"
+#include "ProofNumberSearch.h"
+#include "SearchTrace.h"
+
+/*
+	Correctness and speed numbers for the Board primitives the search spends its time in.
+
+	The perft section counts every move sequence of a given length from the empty board
+	that doesn't continue a game after it was won, and compares the totals with reference
+	values from an independent array based implementation. The batch section plays every
+	column of each position of a fixed corpus of random positions with Board::PlayAll and
+	scores the children with the batched WeightedOpenThreeInARows, and counts the children
+	whose win, threats or score differ from those of Play and the scan one board at a time.
+	The timing section calls each primitive on the corpus and reports nanoseconds per call.
+	The output has one line per result in a fixed order, so two runs can be compared with
+	diff. The exit code is 2 if a perft count is wrong or a batch result differs.
+
+	The search section runs the AI on a few fixed positions with and without enhanced
+	transposition cutoffs. It uses the deterministic mode, so the node counts are the same
+	on every run and any change in them comes from a change to the search. The last column
+	is the share of heuristic leaves answered by the evaluation caches.
+
+	The analyze section scores the best column and then every column of the same positions
+	with AI::Analyze, whose node counts can be compared with those of the search section.
+
+	The prove section takes positions the player to move wins by force and compares the
+	exhaustive search with the proof-number search, which only proves that the win exists.
+
+	With -trace, a build with SEARCH_TRACE defined writes a timeline of the search section's
+	threads to FILE, to be opened in chrome://tracing or Perfetto.
+
+	Usage:
+		Benchmark [-perft DEPTH] [-positions N] [-seed S] [-repeats R] [-search 0|1] [-trace FILE]
+*/
+
+
+namespace
+{
+	struct Settings
+	{
+		int perftDepth = 8;
+		int positions = 10000;
+		unsigned int seed = 1;
+		int repeats = 50;
+		bool search = true;
+		std::string traceFile;
+	};
+
+	// moves written as columns 1-7, and the engine options to search them with
+	const char* const searchPositions[][2] {
+		{ "", "depth=11,maxdepth=11,exact=100" },
+		{ "4453", "depth=11,maxdepth=11,exact=100" },
+		{ "4443434422336677", "exact=0" },
+		{ "444343442233667715", "exact=0" },
+	};
+
+	// wins for the player to move, moves written as columns 1-7
+	const char* const provenWins[] {
+		"51465366335765536714",
+		"11752421244257672324",
+		"56534764665441253221",
+	};
+
+	// move sequences of each length from the empty board, index is the length
+	constexpr unsigned long long perftReference[] {
+		1ULL, 7ULL, 49ULL, 343ULL, 2401ULL, 16807ULL, 117649ULL, 823536ULL,
+		5673234ULL, 39394572ULL, 268031646ULL
+	};
+	constexpr int MAX_REFERENCE_DEPTH = sizeof(perftReference) / sizeof(perftReference[0]) - 1;
+
+	// values are accumulated here so that the compiler can't discard the timed calls
+	volatile unsigned long long sink;
+
+	// the search's move order, for the children of corpus positions
+	constexpr int moveOrder[] { 3, 4, 2, 5, 1, 6, 0 };
+
+
+	unsigned long long Perft(const Board& board, int depth)
+	{
+		if (depth == 0) {
+			return 1;
+		}
+		unsigned long long nodes = 0;
+		for (int col = 0; col < Board::WIDTH; ++col) {
+			if (board.IsColumnFull(col)) {
+				continue;
+			}
+			if (depth == 1) {
+				++nodes;
+				continue;
+			}
+			Board child(board);
+			if (!child.Play(col)) {
+				nodes += Perft(child, depth - 1);
+			}
+		}
+		return nodes;
+	}
+
+
+	struct Position
+	{
+		Board board;
+		int column;		// a legal move in board
+	};
+
+
+	std::vector<Position> MakeCorpus(const Settings& settings)
+	{
+		std::mt19937 rng(settings.seed);
+		std::vector<Position> corpus;
+		while ((int) corpus.size() < settings.positions) {
+			Board board;
+			int plies = rng() % (Board::WIDTH * Board::HEIGHT - 6);
+			for (int i = 0; i < plies && board.GetWinner() == CHIP_NONE; ++i) {
+				int col;
+				do {
+					col = rng() % Board::WIDTH;
+				} while (board.IsColumnFull(col));
+				board.Drop(col);
+			}
+			if (board.GetWinner() != CHIP_NONE || board.IsBoardFull()) {
+				continue;
+			}
+			Position position;
+			position.board = board;
+			do {
+				position.column = rng() % Board::WIDTH;
+			} while (board.IsColumnFull(position.column));
+			corpus.push_back(position);
+		}
+		return corpus;
+	}
+
+
+	// Returns false if any count differs from the reference
+	bool RunPerft(const Settings& settings)
+	{
+		bool correct = true;
+		std::cout << "perft depth nodes reference result ms\n";
+		for (int depth = 1; depth <= settings.perftDepth; ++depth) {
+			auto start = std::chrono::steady_clock::now();
+			unsigned long long nodes = Perft(Board(), depth);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "perft " << depth << " " << nodes << " ";
+			if (depth <= MAX_REFERENCE_DEPTH) {
+				std::cout << perftReference[depth] << " " << (nodes == perftReference[depth] ? "ok" : "MISMATCH");
+				correct = correct && nodes == perftReference[depth];
+			}
+			else {
+				std::cout << "- -";
+			}
+			std::cout << " " << std::fixed << std::setprecision(1) << ms << "\n";
+		}
+		return correct;
+	}
+
+
+	// Calls function once per corpus position per repeat and prints the mean time per call
+	template<class Function>
+	void Time(const std::string& name, const std::vector<Position>& corpus, int repeats, int callsPerPosition, Function function)
+	{
+		unsigned long long total = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r) {
+			for (const Position& position : corpus) {
+				total += function(position);
+			}
+		}
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		sink = sink + total;
+		double calls = (double) corpus.size() * repeats * callsPerPosition;
+		std::cout << "time " << std::left << std::setw(31) << name << std::right
+			<< std::fixed << std::setprecision(2) << ns / calls << "\n";
+	}
+
+
+	// Returns false if any child differs
+	bool RunBatchCheck(const std::vector<Position>& corpus)
+	{
+		unsigned long long children = 0;
+		unsigned long long mismatches = 0;
+		for (const Position& position : corpus) {
+			Board batch[Board::WIDTH];
+			int columns[Board::WIDTH];
+			bool won[Board::WIDTH];
+			Board::Bitboard threats[Board::WIDTH];
+			int scores[Board::WIDTH];
+			int numChildren = position.board.PlayAll(moveOrder, batch, columns, won, threats);
+			Board::WeightedOpenThreeInARows(batch, numChildren, scores);
+			for (int i = 0; i < numChildren; ++i) {
+				Board child(position.board);
+				bool childWon = child.Play(columns[i]);
+				bool same = child == batch[i] && childWon == won[i] && child.GetWinner() == batch[i].GetWinner()
+					&& threats[i] == (child.GetThreats(position.board.GetThisTurn()) & child.GetPlayableMoves())
+					&& (childWon || scores[i] == child.WeightedOpenThreeInARows(child.GetThisTurn()));
+				++children;
+				mismatches += !same;
+			}
+		}
+		std::cout << "batch lanes children mismatches result\n";
+		std::cout << "batch " << Board::LANES << " " << children << " " << mismatches << " " << (mismatches ? "MISMATCH" : "ok") << "\n";
+		return mismatches == 0;
+	}
+
+
+	void RunTimings(const Settings& settings, const std::vector<Position>& corpus)
+	{
+		std::cout << "time primitive ns_per_call\n";
+
+		// the loop over the corpus is included in every line, this one measures it alone
+		Time("Loop overhead", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			return (unsigned long long) position.column;
+		});
+		Time("Board copy + Drop", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			Board child(position.board);
+			return (unsigned long long) child.Drop(position.column);
+		});
+		Time("Board copy + Drop + GetWinner", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			Board child(position.board);
+			child.Drop(position.column);
+			return (unsigned long long) child.GetWinner();
+		});
+		Time("Board copy + Play", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			Board child(position.board);
+			return (unsigned long long) child.Play(position.column);
+		});
+		Time("CheckWinner", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			return (unsigned long long) position.board.CheckWinner();
+		});
+		Time("IsColumnFull", corpus, settings.repeats, Board::WIDTH, [](const Position& position)
+		{
+			unsigned long long full = 0;
+			for (int col = 0; col < Board::WIDTH; ++col) {
+				full += position.board.IsColumnFull(col);
+			}
+			return full;
+		});
+		Time("GetPlayableMoves", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			return position.board.GetPlayableMoves();
+		});
+		Time("WeightedOpenThreeInARows", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			return (unsigned long long) position.board.WeightedOpenThreeInARows(position.board.GetThisTurn());
+		});
+		// every child of the position, the way the search scores the children of a node one
+		// ply above the horizon before and after it batched them
+		Time("Score children one at a time", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			unsigned long long total = 0;
+			for (int col : moveOrder) {
+				if (!position.board.IsColumnFull(col)) {
+					Board child(position.board);
+					if (!child.Play(col)) {
+						total += child.WeightedOpenThreeInARows(child.GetThisTurn());
+					}
+				}
+			}
+			return total;
+		});
+		Time("Score children in batches", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			Board children[Board::WIDTH];
+			int columns[Board::WIDTH];
+			bool won[Board::WIDTH];
+			Board::Bitboard threats[Board::WIDTH];
+			int scores[Board::WIDTH];
+			int numChildren = position.board.PlayAll(moveOrder, children, columns, won, threats);
+			Board::WeightedOpenThreeInARows(children, numChildren, scores);
+			unsigned long long total = 0;
+			for (int i = 0; i < numChildren; ++i) {
+				if (!won[i]) {
+					total += scores[i];
+				}
+			}
+			return total;
+		});
+		Time("IsWinRefuted", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			return (unsigned long long) position.board.IsWinRefuted();
+		});
+		Time("std::hash<Board>", corpus, settings.repeats, 1, [](const Position& position)
+		{
+			return (unsigned long long) std::hash<Board>()(position.board);
+		});
+	}
+
+
+	void RunSearches()
+	{
+		std::cout << "search moves etc column score nodes ms evalhit%\n";
+		for (const auto& position : searchPositions) {
+			Board board;
+			for (const char* move = position[0]; *move; ++move) {
+				board.Drop(*move - '1');
+			}
+			for (int etc = 0; etc < 2; ++etc) {
+				AI::Options options;
+				options.verbose = false;
+				options.deterministic = true;
+				ParseOptions(position[1], options);
+				options.enhancedCutoffs = (etc == 1);
+				AI ai(options);
+				AI::SearchResult result = ai.Search(board);
+				const AI::Statistics& statistics = ai.GetStatistics();
+				std::cout << "search " << (*position[0] ? position[0] : "-") << " " << etc << " " << result.column + 1 << " "
+					<< result.score << " " << statistics.nodes << " " << std::fixed << std::setprecision(1)
+					<< statistics.seconds * 1000.0 << " "
+					<< (statistics.evalProbes ? 100.0 * statistics.evalHits / statistics.evalProbes : 0.0) << "\n";
+			}
+		}
+	}
+
+
+	void RunAnalyses()
+	{
+		std::cout << "analyze moves count scores nodes ms\n";
+		for (const auto& position : searchPositions) {
+			Board board;
+			for (const char* move = position[0]; *move; ++move) {
+				board.Drop(*move - '1');
+			}
+			for (int count : { 1, Board::WIDTH }) {
+				AI::Options options;
+				options.verbose = false;
+				ParseOptions(position[1], options);
+				AI ai(options);
+				std::vector<AI::MoveScore> scores = ai.Analyze(board, count);
+				std::cout << "analyze " << (*position[0] ? position[0] : "-") << " " << count << " ";
+				for (std::size_t i = 0; i < scores.size(); ++i) {
+					std::cout << (i ? "," : "") << scores[i].column + 1 << ":" << scores[i].score;
+				}
+				const AI::Statistics& statistics = ai.GetStatistics();
+				std::cout << " " << statistics.nodes << " " << std::fixed << std::setprecision(1) << statistics.seconds * 1000.0 << "\n";
+			}
+		}
+	}
+
+
+	void RunProofs()
+	{
+		std::cout << "prove moves column score nodes ms pns_column pns_nodes pns_ms\n";
+		for (const char* moves : provenWins) {
+			Board board;
+			for (const char* move = moves; *move; ++move) {
+				board.Drop(*move - '1');
+			}
+			AI::Options options;
+			options.verbose = false;
+			options.deterministic = true;
+			options.exactSearchMove = 0;
+			AI ai(options);
+			AI::SearchResult result = ai.Search(board);
+			const AI::Statistics& statistics = ai.GetStatistics();
+
+			ProofNumberSearch prover((ProofNumberSearch::Options()));
+			auto start = std::chrono::steady_clock::now();
+			int column = -1;
+			if (prover.Prove(board, board.GetThisTurn()) == ProofNumberSearch::Result::PROVEN) {
+				column = prover.GetWinningMove(board);
+			}
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "prove " << moves << " " << result.column + 1 << " " << result.score << " " << statistics.nodes << " "
+				<< std::fixed << std::setprecision(1) << statistics.seconds * 1000.0 << " "
+				<< column + 1 << " " << prover.GetNodes() << " " << ms << "\n";
+		}
+	}
+
+
+	bool ParseArguments(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (i + 1 >= argc) {
+				return false;
+			}
+			if (arg == "-trace") {
+				settings.traceFile = argv[++i];
+				continue;
+			}
+			int value = std::atoi(argv[++i]);
+			if (arg == "-perft") {
+				settings.perftDepth = value;
+			}
+			else if (arg == "-positions") {
+				settings.positions = value;
+			}
+			else if (arg == "-seed") {
+				settings.seed = (unsigned int) value;
+			}
+			else if (arg == "-repeats") {
+				settings.repeats = value;
+			}
+			else if (arg == "-search") {
+				settings.search = (value != 0);
+			}
+			else {
+				return false;
+			}
+		}
+		return settings.positions > 0 && settings.repeats > 0;
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!ParseArguments(argc, argv, settings)) {
+		std::cerr << "Usage: Benchmark [-perft DEPTH] [-positions N] [-seed S] [-repeats R] [-search 0|1] [-trace FILE]\n";
+		return 1;
+	}
+	bool correct = RunPerft(settings);
+	std::vector<Position> corpus = MakeCorpus(settings);
+	std::cout << "corpus positions " << corpus.size() << " seed " << settings.seed << " repeats " << settings.repeats << "\n";
+	correct = RunBatchCheck(corpus) && correct;
+	RunTimings(settings, corpus);
+	if (settings.search) {
+		SearchTrace::Clear();
+		RunSearches();
+		if (!settings.traceFile.empty() && !SearchTrace::Export(settings.traceFile)) {
+			std::cerr << "No trace written to " << settings.traceFile << ", tracing needs SEARCH_TRACE defined\n";
+		}
+		RunAnalyses();
+		RunProofs();
+	}
+	return correct ? 0 : 2;
+}
@@ -1,19 +1,29 @@
 // Noah Rubin
 
 #include <cmath>
-#include <intrin.h>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 
 #include "Board.h"
 #include "Build.h"
 
+#ifdef __AVX2__
+#	include <immintrin.h>
+#endif
+
 #define BITBOARD_FIRST_COLUMN		0x0101010101010101ULL
 #define BITBOARD_MAIN_DIAGONAL		0x0102040810204080ULL
 #define BITBOARD_MAIN_ANTIDIAGONAL	0x8040201008040201ULL
 #define BITBOARD_ALL_BITS			0xFFFFFFFFFFFFFFFFULL
 #define BITBOARD_LEAST_BYTE			0x7F
 #define BITBOARD_FULL				0x7F7F7F7F7F7FULL
+#define BITBOARD_BOTTOM_ROW			0x7F0000000000ULL
+#define BITBOARD_BOTTOM_LEFT		40
+#define BITBOARD_VERTICAL_FOUR		0x01010101ULL
+#define BITBOARD_ODD_HEIGHTS		0x007F007F007FULL	// rows 2, 4 and 6 counting from the bottom
+#define BITBOARD_EVEN_HEIGHTS		0x7F007F007F00ULL	// rows 1, 3 and 5 counting from the bottom
+#define BITBOARD_FIRST_SIX_COLUMNS	0x3F3F3F3F3F3FULL
 
 /*
 	The bitboard represents the game board like this:
@@ -27,12 +37,36 @@
 
 	Each byte represents a row, with the least-significant byte representing the top.
 	The last bit of each byte is unused and always zero.
+
+	Besides a bitboard per player, the board keeps the union of the two and the number of
+	chips in each column, so that neither dropping a chip nor finding the legal moves needs
+	a bit scan.
 */
 
 
 namespace
 {
-	Board::Bitboard insertTable[7][6];
+	// Rows and columns between neighbouring cells of a horizontal, diagonal and antidiagonal line
+	constexpr int lineSteps[][2] { { 0, 1 }, { 1, -1 }, { 1, 1 } };
+
+	// The cells up to three away from each cell along each of the lines above, the only
+	// ones that can complete a four in a row together with it
+	Board::Bitboard lineMasks[48][3];
+
+	// Every four in a row that fits on the board
+	constexpr int NUM_GROUPS = 69;
+	Board::Bitboard groups[NUM_GROUPS];
+
+	// Ends of the diagonals and antidiagonals at least four cells long, in the order
+	// OpenThreeInARows scans them
+	constexpr int diagonalStarts[] { 24, 32, 40, 41, 42, 43 };
+	constexpr int diagonalEnds[] { 3, 4, 5, 6, 14, 22 };
+	constexpr int antidiagonalStarts[] { 0, 1, 2, 3, 8, 16 };
+	constexpr int antidiagonalEnds[] { 45, 46, 38, 30, 44, 43 };
+
+	// The lines OpenThreeInARows scans, its rows, columns, diagonals and antidiagonals in the
+	// order it scans them
+	Board::Bitboard scanLines[4][6];
 
 
 	struct InitTableHelper
@@ -41,7 +75,46 @@ namespace
 		{
 			for (int c = 0; c < Board::WIDTH; ++c) {
 				for (int r = 0; r < Board::HEIGHT; ++r) {
-					insertTable[c][r] = 1ULL << (8ULL * r + c);
+					for (int d = 0; d < 3; ++d) {
+						Board::Bitboard mask = 0;
+						for (int k = -3; k <= 3; ++k) {
+							int row = r + k * lineSteps[d][0];
+							int col = c + k * lineSteps[d][1];
+							if (row >= 0 && row < Board::HEIGHT && col >= 0 && col < Board::WIDTH) {
+								mask |= 1ULL << (8 * row + col);
+							}
+						}
+						lineMasks[8 * r + c][d] = mask;
+					}
+				}
+			}
+			static constexpr int groupSteps[][2] { { 0, 1 }, { 1, 0 }, { 1, -1 }, { 1, 1 } };
+			int numGroups = 0;
+			for (int c = 0; c < Board::WIDTH; ++c) {
+				for (int r = 0; r < Board::HEIGHT; ++r) {
+					for (int d = 0; d < 4; ++d) {
+						int lastRow = r + 3 * groupSteps[d][0];
+						int lastCol = c + 3 * groupSteps[d][1];
+						if (lastRow >= Board::HEIGHT || lastCol < 0 || lastCol >= Board::WIDTH) {
+							continue;
+						}
+						Board::Bitboard mask = 0;
+						for (int k = 0; k < 4; ++k) {
+							mask |= 1ULL << (8 * (r + k * groupSteps[d][0]) + c + k * groupSteps[d][1]);
+						}
+						groups[numGroups++] = mask;
+					}
+				}
+			}
+			for (int i = 0; i < 6; ++i) {
+				scanLines[0][i] = Board::Bitboard(BITBOARD_LEAST_BYTE) << 8 * i;
+				scanLines[1][i] = (BITBOARD_FIRST_COLUMN << i) & BITBOARD_FULL;
+				scanLines[2][i] = scanLines[3][i] = 0;
+				for (int j = diagonalStarts[i]; j >= diagonalEnds[i]; j -= 7) {
+					scanLines[2][i] |= 1ULL << j;
+				}
+				for (int j = antidiagonalStarts[i]; j <= antidiagonalEnds[i]; j += 9) {
+					scanLines[3][i] |= 1ULL << j;
 				}
 			}
 		}
@@ -50,26 +123,417 @@ namespace
 	InitTableHelper dummy;
 
 
-	inline void Insert(Board::Bitboard& board, unsigned long col, unsigned long row)
+	// Whether the chip at cell is part of four in a row on board. Written out rather than
+	// looped so that every shift is a constant.
+	inline bool IsFourThrough(Board::Bitboard board, int cell)
+	{
+		// the last chip is on top of its column, so only the three cells below it matter
+		if (((board >> cell) & BITBOARD_VERTICAL_FOUR) == BITBOARD_VERTICAL_FOUR) {
+			return true;
+		}
+		Board::Bitboard line = board & lineMasks[cell][0];
+		line &= line >> 1ULL;
+		if (line & (line >> 2ULL)) {
+			return true;
+		}
+		line = board & lineMasks[cell][1];
+		line &= line >> 7ULL;
+		if (line & (line >> 14ULL)) {
+			return true;
+		}
+		line = board & lineMasks[cell][2];
+		line &= line >> 9ULL;
+		return (line & (line >> 18ULL)) != 0;
+	}
+
+
+	// Whether the playable cells in cells can be split into baseinverse pairs such that every
+	// line in lines contains both cells of one of the pairs. pairs holds the pairs chosen so far.
+	bool MatchBaseinverses(Board::Bitboard cells, const Board::Bitboard* lines, int numLines, Board::Bitboard* pairs, int numPairs)
+	{
+		if (!cells) {
+			for (int i = 0; i < numLines; ++i) {
+				bool covered = false;
+				for (int j = 0; j < numPairs && !covered; ++j) {
+					covered = (lines[i] & pairs[j]) == pairs[j];
+				}
+				if (!covered) {
+					return false;
+				}
+			}
+			return true;
+		}
+		Board::Bitboard first = cells & (~cells + 1);
+		for (Board::Bitboard rest = cells ^ first; rest; rest &= rest - 1) {
+			pairs[numPairs] = first | (rest & (~rest + 1));
+			if (MatchBaseinverses(cells ^ pairs[numPairs], lines, numLines, pairs, numPairs + 1)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+#ifdef __AVX2__
+	// Board::LANES bitboards side by side in an AVX2 register, with the operators of a single
+	// one. A bitboard on its own stands for the same one in every lane.
+	struct Lanes
+	{
+		__m256i bits;
+
+		Lanes() = default;
+
+		Lanes(__m256i bits) :
+			bits(bits)
+		{
+		}
+
+		Lanes(Board::Bitboard bits) :
+			bits(_mm256_set1_epi64x((long long) bits))
+		{
+		}
+	};
+
+	inline Lanes operator&(Lanes a, Lanes b)
+	{
+		return _mm256_and_si256(a.bits, b.bits);
+	}
+
+	inline Lanes operator|(Lanes a, Lanes b)
+	{
+		return _mm256_or_si256(a.bits, b.bits);
+	}
+
+	inline Lanes operator^(Lanes a, Lanes b)
+	{
+		return _mm256_xor_si256(a.bits, b.bits);
+	}
+
+	inline Lanes operator~(Lanes a)
+	{
+		return _mm256_xor_si256(a.bits, _mm256_set1_epi64x(-1));
+	}
+
+	inline Lanes operator<<(Lanes a, int bits)
+	{
+		return _mm256_slli_epi64(a.bits, bits);
+	}
+
+	inline Lanes operator>>(Lanes a, int bits)
+	{
+		return _mm256_srli_epi64(a.bits, bits);
+	}
+
+	inline Lanes operator+(Lanes a, Lanes b)
+	{
+		return _mm256_add_epi64(a.bits, b.bits);
+	}
+
+	inline Lanes& operator&=(Lanes& a, Lanes b)
+	{
+		return a = a & b;
+	}
+
+	inline Lanes& operator|=(Lanes& a, Lanes b)
+	{
+		return a = a | b;
+	}
+
+	inline Lanes LoadLanes(const Board::Bitboard* bits)
+	{
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bits));
+	}
+
+	inline void StoreLanes(Board::Bitboard* bits, Lanes lanes)
+	{
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(bits), lanes.bits);
+	}
+
+	// The number of bits set in each lane, from a lookup of the count of each half byte
+	inline Lanes PopCounts(Lanes a)
+	{
+		const __m256i counts = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+		const __m256i lowHalves = _mm256_set1_epi8(0x0F);
+		__m256i bytes = _mm256_add_epi8(
+			_mm256_shuffle_epi8(counts, _mm256_and_si256(a.bits, lowHalves)),
+			_mm256_shuffle_epi8(counts, _mm256_and_si256(_mm256_srli_epi64(a.bits, 4), lowHalves)));
+		return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+	}
+#else
+	typedef Board::Bitboard Lanes;
+
+	inline Lanes LoadLanes(const Board::Bitboard* bits)
+	{
+		return *bits;
+	}
+
+	inline void StoreLanes(Board::Bitboard* bits, Lanes lanes)
+	{
+		*bits = lanes;
+	}
+
+	inline Lanes PopCounts(Lanes a)
+	{
+		return Board::PopCount(a);
+	}
+#endif
+
+
+	// Bit i of the result is bit i + OFFSET of bits, or 0 if that is off the board
+	template<int OFFSET, class B>
+	inline B Shift(B bits)
+	{
+		return OFFSET >= 0 ? bits >> (OFFSET >= 0 ? OFFSET : 0) : bits << (OFFSET >= 0 ? 0 : -OFFSET);
+	}
+
+	inline Board::Bitboard Shift(Board::Bitboard bits, int offset)
+	{
+		return offset >= 0 ? bits >> offset : bits << -offset;
+	}
+
+
+	// The highest bit set in bits, which must not be 0
+	inline Board::Bitboard HighestBit(Board::Bitboard bits)
+	{
+		for (int shift = 1; shift < 64; shift *= 2) {
+			bits |= bits >> shift;
+		}
+		return bits ^ (bits >> 1);
+	}
+
+
+	// The empty cells above the chips in mask, and those of the bottom row
+	template<class B>
+	inline B PlayableCells(B mask)
+	{
+		return ~mask & ((mask >> 8) | B(BITBOARD_BOTTOM_ROW)) & B(BITBOARD_FULL);
+	}
+
+
+	// Cells, empty or not, that complete four in a row along a line STEP bits between cells
+	// with three chips of board
+	template<int STEP, class B>
+	inline B ThreatsAlong(B board)
+	{
+		B pair = (board << STEP) & (board << 2 * STEP);
+		B threats = pair & (board << 3 * STEP);
+		threats |= pair & (board >> STEP);
+		pair = (board >> STEP) & (board >> 2 * STEP);
+		threats |= pair & (board << STEP);
+		return threats | (pair & (board >> 3 * STEP));
+	}
+
+
+	template<class B>
+	inline B ThreatCells(B board)
+	{
+		// three chips below, a cell higher up is a lower bit
+		B threats = (board >> 8) & (board >> 16) & (board >> 24);
+		// along rows, diagonals and antidiagonals the gap bit at the end of each row stops a
+		// line from wrapping around, so it's enough to look three steps in both directions
+		threats |= ThreatsAlong<1>(board);
+		threats |= ThreatsAlong<7>(board);
+		return threats | ThreatsAlong<9>(board);
+	}
+
+
+	// Nonzero if board holds four in a row anywhere
+	template<class B>
+	inline B FourInARow(B board)
+	{
+		B pairs = board & (board >> 1);
+		B fours = pairs & (pairs >> 2);
+		pairs = board & (board >> 7);
+		fours |= pairs & (pairs >> 14);
+		pairs = board & (board >> 8);
+		fours |= pairs & (pairs >> 16);
+		pairs = board & (board >> 9);
+		return fours | (pairs & (pairs >> 18));
+	}
+
+
+	/*
+		The threats OpenThreeInARows lists along the lines of one kind, which it scans cell by
+		cell STEP bits apart, found all at once with shifts. A threat is an empty cell that
+		completes four with three of the player's chips in its line, and the scan lists it
+		when it comes to the cell, if the chips before it in the scan are three in a row or a
+		pair with the third straight after the cell, or when it has passed the chips after
+		the cell. With chips on both sides the cell is listed twice, and std::unique removes
+		the second time unless some other threat was listed in between. Without four in a
+		row on the board no cell can be listed more often along a single line.
+	*/
+	template<class B>
+	struct LineThreats
+	{
+		B afterThree;	// listed on reaching them, after three chips
+		B gaps;			// listed on reaching them, between a pair and a third chip
+		B behind;		// listed after the chips that follow them
+		B repeated;		// both of the above, with nothing listed between the two times
+		B listedAt;		// cells the scan is at when it lists one of the threats
+	};
+
+
+	template<int STEP, class B>
+	LineThreats<B> FindLineThreats(B own, B empty)
+	{
+		B back1 = Shift<-STEP>(own);
+		B back2 = Shift<-2 * STEP>(own);
+		B back3 = Shift<-3 * STEP>(own);
+		B ahead1 = Shift<STEP>(own);
+		B ahead2 = Shift<2 * STEP>(own);
+		B ahead3 = Shift<3 * STEP>(own);
+		B beforeThree = empty & ahead1 & ahead2 & ahead3;
+		// a pair after a gap counts only if the scan reaches a cell past the pair that
+		// would end the run of chips, so not at the end of a line
+		B gapsBehind = empty & back1 & ahead1 & ahead2 & Shift<3 * STEP>(~own & B(BITBOARD_FULL));
+		LineThreats<B> line {
+			empty & back1 & back2 & back3,
+			empty & back1 & back2 & ~back3 & ahead1,
+			beforeThree | gapsBehind,
+			B(0),
+			B(0)
+		};
+		// the first time the scan may also list the cell three steps further back, and the
+		// second time the cell it is at or the one after it
+		B listedBefore = (line.afterThree & Shift<-4 * STEP>(empty)) | (line.gaps & Shift<-4 * STEP>(own) & Shift<-3 * STEP>(empty));
+		B listedAfter = (beforeThree & Shift<4 * STEP>(empty)) | (gapsBehind & Shift<4 * STEP>(own) & Shift<3 * STEP>(empty));
+		line.repeated = (line.afterThree | line.gaps) & line.behind & ~listedBefore & ~listedAfter;
+		line.listedAt = Shift<STEP>(line.afterThree) | line.gaps | Shift<-3 * STEP>(line.behind);
+		return line;
+	}
+
+
+	// Columns are only scanned for three chips below an empty cell, and only the first six
+	// of them
+	template<class B>
+	LineThreats<B> FindColumnThreats(B own, B empty)
+	{
+		B behind = empty & (own >> 8) & (own >> 16) & (own >> 24) & B(BITBOARD_FIRST_SIX_COLUMNS);
+		return LineThreats<B> { B(0), B(0), behind, B(0), behind << 24 };
+	}
+
+
+	// Along the rows, columns, diagonals and antidiagonals, in the order OpenThreeInARows
+	// scans them
+	template<class B>
+	void FindAllLineThreats(B own, B empty, LineThreats<B> (&lines)[4])
+	{
+		lines[0] = FindLineThreats<1>(own, empty);
+		lines[1] = FindColumnThreats(own, empty);
+		lines[2] = FindLineThreats<-7>(own, empty);
+		lines[3] = FindLineThreats<9>(own, empty);
+	}
+
+
+	// The threats of one player as OpenThreeInARows lists them, after std::unique. The count
+	// of a cell is written in bits, each up to 7.
+	template<class B>
+	struct ThreatCounts
+	{
+		B count[3];		// bits 1, 2 and 4 of the number of times each cell is listed
+		B cells;		// cells listed at all
+		B columns;		// cells listed above three chips of a column
+		B crossing;		// cells listed along more than one kind of line
+	};
+
+
+	template<class B>
+	ThreatCounts<B> CountThreats(B own, B empty)
+	{
+		LineThreats<B> lines[4];
+		FindAllLineThreats(own, empty, lines);
+		ThreatCounts<B> counts { { B(0), B(0), B(0) }, B(0), lines[1].behind, B(0) };
+		for (const LineThreats<B>& line : lines) {
+			B reached = line.afterThree | line.gaps;
+			B listed = reached | line.behind;
+			B once = (reached ^ line.behind) | line.repeated;
+			B twice = reached & line.behind & ~line.repeated;
+			// adds once + 2 * twice to the count, once and twice are never both set
+			B carry = counts.count[0] & once;
+			counts.count[0] = counts.count[0] ^ once;
+			carry |= twice;
+			counts.count[2] = counts.count[2] ^ (counts.count[1] & carry);
+			counts.count[1] = counts.count[1] ^ carry;
+			counts.crossing |= counts.cells & listed;
+			counts.cells |= listed;
+		}
+		return counts;
+	}
+
+
+	// The number of times the threats in mask are listed
+	template<class B>
+	inline B CountIn(const ThreatCounts<B>& counts, B mask)
 	{
-		board |= insertTable[col][row];
+		return PopCounts(counts.count[0] & mask) + (PopCounts(counts.count[1] & mask) << 1) + (PopCounts(counts.count[2] & mask) << 2);
 	}
 
 
-	inline unsigned long GetColumn(const Board::Bitboard& board, int col)
+	// The first threat the scan lists at cell at of line, or the last one
+	inline Board::Bitboard FirstListed(const LineThreats<Board::Bitboard>& line, int step, Board::Bitboard at)
+	{
+		Board::Bitboard reached = (Shift(at, -step) & line.afterThree) | (at & line.gaps);
+		return reached ? reached : Shift(at, 3 * step) & line.behind;
+	}
+
+	inline Board::Bitboard LastListed(const LineThreats<Board::Bitboard>& line, int step, Board::Bitboard at)
 	{
-		return ((board & (BITBOARD_FIRST_COLUMN << col)) >> col) * BITBOARD_MAIN_DIAGONAL >> 56ULL;
+		Board::Bitboard behind = Shift(at, 3 * step) & line.behind;
+		return behind ? behind : (Shift(at, -step) & line.afterThree) | (at & line.gaps);
 	}
+
+
+	// Threats OpenThreeInARows lists last along one kind of line and first along the next
+	// kind it finds any along, which std::unique removes as well. Only possible for the cells
+	// ThreatCounts::crossing holds. Returns their number.
+	int FindRepeatsBetweenLines(Board::Bitboard own, Board::Bitboard empty, Board::Bitboard (&repeats)[3])
+	{
+		static constexpr int steps[] { 1, 8, -7, 9 };
+		LineThreats<Board::Bitboard> lines[4];
+		FindAllLineThreats(own, empty, lines);
+		int numRepeats = 0;
+		Board::Bitboard previous = 0;
+		for (int i = 0; i < 4; ++i) {
+			Board::Bitboard first = 0;
+			Board::Bitboard last = 0;
+			for (Board::Bitboard cells : scanLines[i]) {
+				Board::Bitboard listedAt = lines[i].listedAt & cells;
+				if (!listedAt) {
+					continue;
+				}
+				// diagonals are scanned from the bottom up, everything else from the top down
+				Board::Bitboard lowest = listedAt & (~listedAt + 1);
+				Board::Bitboard highest = HighestBit(listedAt);
+				if (!first) {
+					first = FirstListed(lines[i], steps[i], i == 2 ? highest : lowest);
+				}
+				last = LastListed(lines[i], steps[i], i == 2 ? lowest : highest);
+			}
+			if (first) {
+				if (first == previous) {
+					repeats[numRepeats++] = first;
+				}
+				previous = last;
+			}
+		}
+		return numRepeats;
+	}
+
 }
 
 
 Board::Board() :
 	m_boards(),
 	m_thisMove(CHIP_BLACK),
-	m_winner(CHIP_NONE)
+	m_winner(CHIP_NONE),
+	m_lastCell(-1),
+	m_mask(0uLL),
+	m_heights()
 {
 	m_boards[0] = 0uLL;
 	m_boards[1] = 0uLL;
+	std::fill_n(m_heights, WIDTH, 0);
 }
 
 
@@ -79,49 +543,87 @@ bool Board::operator==(const Board& other) const
 }
 
 
-#ifdef BUILD_64
-
 int Board::Drop(int column)
 {
-	static constexpr Bitboard cols[]{
-		BITBOARD_FIRST_COLUMN,
-		BITBOARD_FIRST_COLUMN << 1ULL,
-		BITBOARD_FIRST_COLUMN << 2ULL,
-		BITBOARD_FIRST_COLUMN << 3ULL,
-		BITBOARD_FIRST_COLUMN << 4ULL,
-		BITBOARD_FIRST_COLUMN << 5ULL,
-		BITBOARD_FIRST_COLUMN << 6ULL,
-	};
+	ResolveWinner();
+	int cell = PlaceChip(column);
+	m_lastCell = cell;
+	m_thisMove = GetNextTurn();
+	return cell / 8;
+}
 
-	unsigned long firstSet;
-	if (!_BitScanForward64(&firstSet, (m_boards[0] | m_boards[1]) & cols[column])) {
-		firstSet = 48 + column;
-	}
-	m_boards[m_thisMove] |= 1ULL << (firstSet - 8);
-	if (CheckWinner()) {
+
+bool Board::Play(int column)
+{
+	ResolveWinner();
+	int cell = PlaceChip(column);
+	bool won = IsFourThrough(m_boards[m_thisMove], cell);
+	if (won) {
 		m_winner = m_thisMove;
 	}
 	m_thisMove = GetNextTurn();
-	return firstSet / 8 - 1;
+	return won;
 }
 
-#else
 
-int Board::Drop(int column)
+int Board::PlayAll(const int* order, Board* children, int* columns, bool* won, Bitboard* threats) const
 {
-	unsigned long firstSet;
-	if (!_BitScanForward(&firstSet, GetColumn(m_boards[0] | m_boards[1], column))) {
-		firstSet = HEIGHT;
+	ResolveWinner();
+	int numChildren = 0;
+	for (int i = 0; i < WIDTH; ++i) {
+		if (!IsColumnFull(order[i])) {
+			Board& child = children[numChildren];
+			child = *this;
+			child.PlaceChip(order[i]);
+			child.m_thisMove = GetNextTurn();
+			columns[numChildren++] = order[i];
+		}
 	}
-	Insert(m_boards[m_thisMove], column, firstSet - 1);
-	if (CheckWinner()) {
-		m_winner = m_thisMove;
+	for (int first = 0; first < numChildren; first += LANES) {
+		int numLanes = std::min((int) LANES, numChildren - first);
+		Bitboard boards[LANES] {};
+		Bitboard masks[LANES] {};
+		for (int i = 0; i < numLanes; ++i) {
+			boards[i] = children[first + i].m_boards[m_thisMove];
+			masks[i] = children[first + i].m_mask;
+		}
+		Lanes board = LoadLanes(boards);
+		Lanes mask = LoadLanes(masks);
+		StoreLanes(boards, FourInARow(board));
+		StoreLanes(masks, ThreatCells(board) & PlayableCells(mask));
+		for (int i = 0; i < numLanes; ++i) {
+			won[first + i] = boards[i] != 0;
+			if (won[first + i]) {
+				children[first + i].m_winner = m_thisMove;
+			}
+			threats[first + i] = masks[i];
+		}
 	}
-	m_thisMove = GetNextTurn();
-	return firstSet - 1;
+	return numChildren;
 }
 
-#endif
+
+// Checks the chip dropped last, if it hasn't been already
+void Board::ResolveWinner() const
+{
+	if (m_lastCell >= 0) {
+		if (IsFourThrough(m_boards[GetNextTurn()], m_lastCell)) {
+			m_winner = GetNextTurn();
+		}
+		m_lastCell = -1;
+	}
+}
+
+
+// Adds a chip of the player to move to column and returns its bit
+int Board::PlaceChip(int column)
+{
+	int cell = BITBOARD_BOTTOM_LEFT + column - 8 * m_heights[column]++;
+	Bitboard bit = 1ULL << cell;
+	m_boards[m_thisMove] |= bit;
+	m_mask |= bit;
+	return cell;
+}
 
 
 bool Board::CheckWinner() const
@@ -150,11 +652,6 @@ bool Board::CheckWinner() const
 
 int Board::OpenThreeInARows(Chip chip, int(&threats)[16], int& subtract) const
 {
-	static constexpr int diagonalStarts[]{ 24, 32, 40, 41, 42, 43 };
-	static constexpr int diagonalEnds[]{ 3, 4, 5, 6, 14, 22 };
-	static constexpr int antidiagonalStarts[]{ 0, 1, 2, 3, 8, 16 };
-	static constexpr int antidiagonalEnds[]{ 45, 46, 38, 30, 44, 43 };
-
 	subtract = 0;
 	const Bitboard& board = m_boards[chip];
 	const Bitboard& other = m_boards[chip ^ 1];
@@ -261,21 +758,76 @@ int Board::OpenThreeInARows(Chip chip, int(&threats)[16], int& subtract) const
 
 bool Board::IsColumnFull(int column) const
 {
-	// truncation to long is needed and should be ok because top row is bits 0-7
-	long all = m_boards[0] | m_boards[1];	// might store this so no recalculation needed
-	return _bittest(&all, column);
+	return (m_mask >> column) & 1ULL;	// top row is bits 0-6
 }
 
 
 bool Board::IsBoardFull() const
 {
-	return (m_boards[0] | m_boards[1]) == BITBOARD_FULL;
+	return m_mask == BITBOARD_FULL;
+}
+
+
+Board::Bitboard Board::GetPlayableMoves() const
+{
+	return PlayableCells(m_mask);
 }
 
 
-Chip Board::GetWinner() const
+Board::Bitboard Board::GetThreats(Chip chip) const
+{
+	return ThreatCells(m_boards[chip]) & ~m_mask & BITBOARD_FULL;
+}
+
+
+/*
+	The opponent, the controller, answers each move in the cell paired with it. Every empty
+	cell must belong to exactly one pair, and the partner of a cell must be playable as soon
+	as the cell has been played:
+
+		claimeven	in a column with an even number of empty cells the cells are paired
+					from the bottom up, and the controller gets the upper cell of each pair
+		baseinverse	the lowest empty cells of two columns with an odd number of empty cells,
+					the controller gets one of them but can't choose which
+		vertical	the cells above a baseinverse are paired from the bottom up, and again
+					the controller gets the upper cell of each pair
+
+	Columns with an odd number of empty cells have to be matched up in baseinverses, which is
+	only possible when the total is even, that is with black to move. Every matching is
+	tried until one leaves no line of the player to move without a controller cell in it.
+	Allis's other rules (aftereven, lowinverse, highinverse, before and specialbefore) let the
+	controller leave cells unpaired or depend on threats of his own, so proving them sound
+	needs the full conflict analysis of his VICTOR program and they are not used here.
+*/
+bool Board::IsWinRefuted() const
 {
-	return m_winner;
+	if (m_thisMove != CHIP_BLACK) {
+		return false;	// odd number of empty cells
+	}
+	Bitboard playable = GetPlayableMoves();
+	Bitboard evenColumns = playable & ~BITBOARD_ODD_HEIGHTS;
+	Bitboard oddColumns = playable & BITBOARD_ODD_HEIGHTS;
+	Bitboard controller = m_boards[GetNextTurn()]
+		| (evenColumns >> 8ULL) | (evenColumns >> 24ULL) | (evenColumns >> 40ULL)
+		| (oddColumns >> 16ULL) | (oddColumns >> 32ULL);
+
+	Bitboard open[NUM_GROUPS];
+	int numOpen = 0;
+	for (int i = 0; i < NUM_GROUPS; ++i) {
+		if (!(groups[i] & controller)) {
+			// a line can only be refuted by a baseinverse if it holds both of its cells
+			Bitboard bases = groups[i] & oddColumns;
+			if (!(bases & (bases - 1))) {
+				return false;
+			}
+			open[numOpen++] = bases;
+		}
+	}
+	if (numOpen == 0) {
+		return true;
+	}
+	Bitboard pairs[WIDTH / 2];
+	return MatchBaseinverses(oddColumns, open, numOpen, pairs, 0);
 }
 
 
@@ -291,6 +843,12 @@ Chip Board::GetNextTurn() const
 }
 
 
+Board::Bitboard Board::GetBitboard(Chip chip) const
+{
+	return m_boards[chip];
+}
+
+
 int Board::WeightedOpenThreeInARows(Chip chip) const
 {
 	int blackThreats[16];
@@ -340,3 +898,74 @@ int Board::WeightedOpenThreeInARows(Chip chip) const
 	return chip == CHIP_BLACK ? score : -score;
 }
 
+
+void Board::WeightedOpenThreeInARows(const Board* boards, int num, int* scores)
+{
+	// black's threats count on the second and fourth row from the top, red's on the first,
+	// third and fifth, and every two of red's on the other rows count one more. A threat
+	// right above one of the opponent's doesn't count, and three chips of a column only
+	// lose a point when the cell above them is on one of the player's own rows.
+	constexpr Bitboard blackRows = BITBOARD_EVEN_HEIGHTS & ~BITBOARD_BOTTOM_ROW;
+	constexpr Bitboard redRows = BITBOARD_ODD_HEIGHTS;
+	for (int first = 0; first < num; first += LANES) {
+		int numLanes = std::min((int) LANES, num - first);
+		Bitboard blacks[LANES] {};
+		Bitboard reds[LANES] {};
+		for (int i = 0; i < numLanes; ++i) {
+			blacks[i] = boards[first + i].m_boards[CHIP_BLACK];
+			reds[i] = boards[first + i].m_boards[CHIP_RED];
+		}
+		Lanes black = LoadLanes(blacks);
+		Lanes red = LoadLanes(reds);
+		Lanes empty = ~(black | red) & Lanes(BITBOARD_FULL);
+		ThreatCounts<Lanes> blackThreats = CountThreats(black, empty);
+		ThreatCounts<Lanes> redThreats = CountThreats(red, empty);
+		Lanes blackOpen = ~(redThreats.cells >> 8);
+		Lanes redOpen = ~(blackThreats.cells >> 8);
+
+		Bitboard blackCounts[LANES];
+		Bitboard blackColumns[LANES];
+		Bitboard blackCells[LANES];
+		Bitboard blackCrossing[LANES];
+		Bitboard redCounts[LANES];
+		Bitboard redColumns[LANES];
+		Bitboard redOddCounts[LANES];
+		Bitboard redCells[LANES];
+		Bitboard redCrossing[LANES];
+		StoreLanes(blackCounts, CountIn(blackThreats, blackOpen & Lanes(blackRows)));
+		StoreLanes(blackColumns, PopCounts(blackThreats.columns & Lanes(BITBOARD_EVEN_HEIGHTS)));
+		StoreLanes(blackCells, blackThreats.cells);
+		StoreLanes(blackCrossing, blackThreats.crossing);
+		StoreLanes(redCounts, CountIn(redThreats, redOpen & Lanes(redRows)));
+		StoreLanes(redColumns, PopCounts(redThreats.columns & Lanes(redRows)));
+		StoreLanes(redOddCounts, CountIn(redThreats, redOpen & Lanes(BITBOARD_EVEN_HEIGHTS)));
+		StoreLanes(redCells, redThreats.cells);
+		StoreLanes(redCrossing, redThreats.crossing);
+
+		for (int i = 0; i < numLanes; ++i) {
+			int blackScore = (int) blackCounts[i] - (int) blackColumns[i];
+			int redScore = (int) redCounts[i] - (int) redColumns[i];
+			int redOddThreats = (int) redOddCounts[i];
+			Bitboard laneEmpty = ~(blacks[i] | reds[i]) & BITBOARD_FULL;
+			Bitboard repeats[3];
+			if (blackCrossing[i]) {
+				Bitboard counted = ~(redCells[i] >> 8) & blackRows;
+				int numRepeats = FindRepeatsBetweenLines(blacks[i], laneEmpty, repeats);
+				for (int j = 0; j < numRepeats; ++j) {
+					blackScore -= (repeats[j] & counted) != 0;
+				}
+			}
+			if (redCrossing[i]) {
+				Bitboard open = ~(blackCells[i] >> 8);
+				int numRepeats = FindRepeatsBetweenLines(reds[i], laneEmpty, repeats);
+				for (int j = 0; j < numRepeats; ++j) {
+					redScore -= (repeats[j] & open & redRows) != 0;
+					redOddThreats -= (repeats[j] & open & BITBOARD_EVEN_HEIGHTS) != 0;
+				}
+			}
+			int score = blackScore - redScore - redOddThreats / 2;
+			scores[first + i] = boards[first + i].m_thisMove == CHIP_BLACK ? score : -score;
+		}
+	}
+}
+
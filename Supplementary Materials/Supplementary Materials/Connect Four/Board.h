@@ -27,37 +27,121 @@ public:
 	static constexpr int WIDTH = 7;
 	static constexpr int HEIGHT = 6;
 
+	// Boards the batch functions below work on at once, one to each 64 bit lane of an AVX2
+	// register when the compiler targets AVX2, or else one at a time with the same bitboard
+	// operations
+#ifdef __AVX2__
+	static constexpr int LANES = 4;
+#else
+	static constexpr int LANES = 1;
+#endif
+
 	Board();
 
 	bool operator==(const Board& other) const;
 
+	// Returns the row the chip landed in. Whether it won is only worked out when the
+	// winner is asked for or before the next chip is dropped.
 	int Drop(int column);
 
+	// Same as Drop, but checks the lines through the new chip straight away and returns
+	// whether it won
+	bool Play(int column);
+
+	// Plays each column of order that isn't full on a copy of the board, as Play would, and
+	// returns the number of children. children, columns, won and threats need room for WIDTH
+	// of them. threats gets the cells each move leaves the player who made it to win in next,
+	// GetThreats & GetPlayableMoves of the child. The win check and the threats are worked
+	// out for LANES children at a time. Nobody may have four in a row on the board yet.
+	int PlayAll(const int* order, Board* children, int* columns, bool* won, Bitboard* threats) const;
+
 	bool IsColumnFull(int column) const;
 
 	bool IsBoardFull() const;
 
+	// Number of chips dropped so far
+	int GetMoveCount() const;
+
+	static int PopCount(Bitboard bits);
+
+	// One bit for every column that isn't full, at the cell a chip dropped there lands in
+	Bitboard GetPlayableMoves() const;
+
+	// Empty cells, playable or not, that would complete four in a row for chip
+	Bitboard GetThreats(Chip chip) const;
+
 	Chip GetWinner() const;
 
 	Chip GetThisTurn() const;
 
 	Chip GetNextTurn() const;
 
+	Bitboard GetBitboard(Chip chip) const;
+
+	// Whether the player to move has four in a row anywhere on the board. Drop and Play
+	// only check the lines through the last chip instead.
+	bool CheckWinner() const;
+
 	int WeightedOpenThreeInARows(Chip chip) const;
 
+	// Sets scores[i] to boards[i].WeightedOpenThreeInARows(boards[i].GetThisTurn()) for num
+	// boards, LANES at a time. The threats are found with shifts of the whole bitboards
+	// instead of a scan, which gives the same scores as long as nobody has four in a row,
+	// as on every board the search scores with the heuristic.
+	static void WeightedOpenThreeInARows(const Board* boards, int num, int* scores);
+
+	// Whether the player to move provably can't win. True when the opponent can answer
+	// every move with a fixed partner cell and in doing so takes a cell of every line the
+	// player could still complete (Allis's claimeven, vertical and baseinverse rules). Only
+	// ever true when the number of empty cells is even.
+	bool IsWinRefuted() const;
+
 private:
 	Bitboard m_boards[2];
 	Chip m_thisMove;
-	Chip m_winner;
+	mutable Chip m_winner;
+	mutable int m_lastCell;		// bit of the last chip until it has been checked for a win, -1 after
+	Bitboard m_mask;			// chips of both players
+	unsigned char m_heights[WIDTH];
 
 	friend struct std::hash<Board>;
 
-	bool CheckWinner() const;
+	int PlaceChip(int column);
+
+	void ResolveWinner() const;
 
 	int OpenThreeInARows(Chip chip, int (&threats)[16], int& subtract) const;
 };
 
 
+// Inline because the search asks for the winner several times at every node
+inline Chip Board::GetWinner() const
+{
+	if (m_lastCell >= 0) {
+		ResolveWinner();
+	}
+	return m_winner;
+}
+
+
+// Branchless, since the positions of the bits it counts are unpredictable
+inline int Board::PopCount(Bitboard bits)
+{
+	Bitboard count = bits - ((bits >> 1) & 0x5555555555555555ULL);
+	count = (count & 0x3333333333333333ULL) + ((count >> 2) & 0x3333333333333333ULL);
+	count = (count + (count >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int) ((count * 0x0101010101010101ULL) >> 56);
+}
+
+
+// Inline because the search works out its ply from it at every node. A count of the bits in
+// the mask, rather than a sum of the column heights.
+inline int Board::GetMoveCount() const
+{
+	return PopCount(m_mask);
+}
+
+
 namespace std
 {
 	template<>
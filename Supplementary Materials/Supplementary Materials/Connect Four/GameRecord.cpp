@@ -0,0 +1,139 @@
+// Noah Rubin
+
+#include <cstring>
+#include <cstdint>
+
+#include "Board.h"
+#include "GameRecord.h"
+
+
+namespace
+{
+	constexpr std::uint32_t RECORD_VERSION = 1;
+	constexpr char RECORD_MAGIC[4] { 'C', '4', 'G', 'R' };
+	constexpr int BITS_PER_MOVE = 3;
+	constexpr int MAX_MOVES = Board::WIDTH * Board::HEIGHT;
+
+
+	struct RecordHeader
+	{
+		char magic[4];
+		std::uint32_t version;
+		std::uint64_t numGames;
+	};
+
+
+	std::size_t PackedBytes(int numMoves)
+	{
+		return (std::size_t) (numMoves * BITS_PER_MOVE + 7) / 8;
+	}
+}
+
+
+GameRecordWriter::GameRecordWriter(const std::string& path) :
+	m_out(path, std::ios::binary),
+	m_numGames(0)
+{
+	// the game count is filled in by Close
+	RecordHeader header;
+	std::memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	header.version = RECORD_VERSION;
+	header.numGames = 0;
+	m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+
+GameRecordWriter::~GameRecordWriter()
+{
+	Close();
+}
+
+
+bool GameRecordWriter::Add(const std::vector<int>& moves)
+{
+	if (moves.size() > (std::size_t) MAX_MOVES) {
+		return false;
+	}
+	unsigned char packed[2 + (MAX_MOVES * BITS_PER_MOVE + 7) / 8] {};	// one spare byte for the last move's high bits
+	packed[0] = (unsigned char) moves.size();
+	for (std::size_t i = 0; i < moves.size(); ++i) {
+		if (moves[i] < 0 || moves[i] >= Board::WIDTH) {
+			return false;
+		}
+		std::size_t bit = i * BITS_PER_MOVE;
+		unsigned int shifted = (unsigned int) moves[i] << (bit % 8);
+		packed[1 + bit / 8] |= (unsigned char) shifted;
+		packed[2 + bit / 8] |= (unsigned char) (shifted >> 8);
+	}
+	m_out.write(reinterpret_cast<const char*>(packed), 1 + PackedBytes((int) moves.size()));
+	++m_numGames;
+	return true;
+}
+
+
+bool GameRecordWriter::Close()
+{
+	if (!m_out.is_open()) {
+		return false;
+	}
+	std::uint64_t numGames = m_numGames;
+	m_out.seekp(offsetof(RecordHeader, numGames));
+	m_out.write(reinterpret_cast<const char*>(&numGames), sizeof(numGames));
+	bool ok = m_out.good();
+	m_out.close();
+	return ok;
+}
+
+
+GameRecordReader::GameRecordReader(const std::string& path) :
+	m_file(path),
+	m_begin(nullptr),
+	m_pos(nullptr),
+	m_end(nullptr),
+	m_numGames(0)
+{
+	RecordHeader header;
+	if (!m_file.GetData() || m_file.GetSize() < sizeof(header)) {
+		return;
+	}
+	std::memcpy(&header, m_file.GetData(), sizeof(header));
+	if (std::memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 || header.version != RECORD_VERSION) {
+		return;
+	}
+	m_begin = static_cast<const unsigned char*>(m_file.GetData()) + sizeof(header);
+	m_pos = m_begin;
+	m_end = static_cast<const unsigned char*>(m_file.GetData()) + m_file.GetSize();
+	m_numGames = header.numGames;
+}
+
+
+bool GameRecordReader::Next(std::vector<int>& moves)
+{
+	if (m_pos == m_end || !m_pos) {
+		return false;
+	}
+	int numMoves = *m_pos;
+	std::size_t bytes = PackedBytes(numMoves);
+	if (numMoves > MAX_MOVES || (std::size_t) (m_end - m_pos - 1) < bytes) {
+		m_pos = m_end;
+		return false;
+	}
+	const unsigned char* packed = m_pos + 1;
+	moves.resize(numMoves);
+	for (int i = 0; i < numMoves; ++i) {
+		int bit = i * BITS_PER_MOVE;
+		unsigned int word = packed[bit / 8];
+		if (bit % 8 > 8 - BITS_PER_MOVE) {
+			word |= (unsigned int) packed[bit / 8 + 1] << 8;
+		}
+		moves[i] = (word >> (bit % 8)) & 7;
+	}
+	m_pos += 1 + bytes;
+	return true;
+}
+
+
+void GameRecordReader::Rewind()
+{
+	m_pos = m_begin;
+}
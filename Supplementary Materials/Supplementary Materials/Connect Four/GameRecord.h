@@ -0,0 +1,101 @@
+// Noah Rubin
+
+#ifndef GAME_RECORD_H_INCLUDED
+#define GAME_RECORD_H_INCLUDED
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Build.h"
+#include "MappedFile.h"
+
+/*
+	Compact binary storage for large collections of games, with moves given as columns 0-6.
+
+	A file starts with a 16 byte header holding the format version and the number of games,
+	followed by the games one after another. Each game is a byte with its number of moves
+	and then the moves packed three bits each, least significant bits first, padded to a
+	whole byte, so that a full game of 42 moves takes 17 bytes.
+*/
+
+class GameRecordWriter
+{
+public:
+	explicit GameRecordWriter(const std::string& path);
+
+	GameRecordWriter(const GameRecordWriter& copy) = delete;
+
+	GameRecordWriter& operator=(const GameRecordWriter& copy) = delete;
+
+	~GameRecordWriter();
+
+	bool IsOpen() const;
+
+	// Returns false and writes nothing if a move is not a column or there are more moves
+	// than fit on the board
+	bool Add(const std::vector<int>& moves);
+
+	// Writes the number of games into the header. Returns false if any write failed.
+	bool Close();
+
+	unsigned long long GetNumGames() const;
+
+private:
+	std::ofstream m_out;
+	unsigned long long m_numGames;
+};
+
+
+// Reads the games of a file written by GameRecordWriter in order, decoding them straight
+// from a memory mapping of the file
+class GameRecordReader
+{
+public:
+	explicit GameRecordReader(const std::string& path);
+
+	// Whether the file exists and has the header of a game record
+	bool IsOpen() const;
+
+	unsigned long long GetNumGames() const;
+
+	// Decodes the next game into moves. Returns false at the end of the file or if the
+	// rest of the file is truncated.
+	bool Next(std::vector<int>& moves);
+
+	void Rewind();
+
+private:
+	MappedFile m_file;
+	const unsigned char* m_begin;
+	const unsigned char* m_pos;
+	const unsigned char* m_end;
+	unsigned long long m_numGames;
+};
+
+
+inline bool GameRecordWriter::IsOpen() const
+{
+	return m_out.is_open();
+}
+
+
+inline unsigned long long GameRecordWriter::GetNumGames() const
+{
+	return m_numGames;
+}
+
+
+inline bool GameRecordReader::IsOpen() const
+{
+	return m_begin != nullptr;
+}
+
+
+inline unsigned long long GameRecordReader::GetNumGames() const
+{
+	return m_numGames;
+}
+
+#endif // !GAME_RECORD_H_INCLUDED
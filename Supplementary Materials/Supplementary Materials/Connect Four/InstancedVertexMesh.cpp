@@ -1,15 +1,66 @@
 // Noah Rubin
 
+#include <algorithm>
+
 #include "Mesh.h"
+#include "VertexAttributeHelpers.h"
 
 InstancedVertexMesh::InstancedVertexMesh(
-	const std::vector<VertexAttribute>& attribs,
+	const void* vertices,
+	GLsizei numVertices,
+	const AttributeLayout& layout,
+	const std::vector<VertexAttribute>& instanceAttribs,
 	GLenum primitive,
 	GLsizei numInstances
 	) :
-	VertexMesh(attribs, primitive),
-	m_numInstances(numInstances)
+	VertexMesh(vertices, numVertices, layout, primitive, numVertices, false),
+	m_instanceAttribs(instanceAttribs),
+	m_instanceBuffers(instanceAttribs.size()),
+	m_numInstances(numInstances),
+	m_capacity(numInstances)
+{
+	for (VertexAttribute& attrib : m_instanceAttribs) {
+		attrib.offset = 0;
+	}
+	if (!m_instanceBuffers.empty()) {
+		glGenBuffers((GLsizei) m_instanceBuffers.size(), m_instanceBuffers.data());
+	}
+	for (std::size_t i = 0; i < m_instanceBuffers.size(); ++i) {
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, GetInstanceStride(i) * m_capacity, nullptr, GL_DYNAMIC_DRAW);
+		AttachInstanceBuffer(i);
+	}
+	glBindVertexArray(0);
+}
+
+
+InstancedVertexMesh::InstancedVertexMesh(InstancedVertexMesh&& move) :
+	VertexMesh(std::move(move)),
+	m_instanceAttribs(std::move(move.m_instanceAttribs)),
+	m_instanceBuffers(std::move(move.m_instanceBuffers)),
+	m_numInstances(move.m_numInstances),
+	m_capacity(move.m_capacity)
+{
+	move.m_instanceBuffers.clear();
+}
+
+
+InstancedVertexMesh& InstancedVertexMesh::operator=(InstancedVertexMesh&& move)
 {
+	VertexMesh::operator=(std::move(move));
+	m_instanceAttribs.swap(move.m_instanceAttribs);
+	m_instanceBuffers.swap(move.m_instanceBuffers);
+	m_numInstances = move.m_numInstances;
+	m_capacity = move.m_capacity;
+	return *this;
+}
+
+
+InstancedVertexMesh::~InstancedVertexMesh()
+{
+	if (!m_instanceBuffers.empty()) {
+		glDeleteBuffers((GLsizei) m_instanceBuffers.size(), m_instanceBuffers.data());
+	}
 }
 
 
@@ -18,4 +69,65 @@ void InstancedVertexMesh::Render() const
 	glBindVertexArray(GetVao());
 	glDrawArraysInstanced(GetPrimitive(), 0, GetNumVerts(), m_numInstances);
 	glBindVertexArray(0);
-}
\ No newline at end of file
+}
+
+
+// The buffers grow to at least twice their size, so that adding instances one at a time
+// only copies them a logarithmic number of times
+void InstancedVertexMesh::SetInstances(GLsizei num)
+{
+	m_numInstances = num;
+	if (num <= m_capacity) {
+		return;
+	}
+	GLsizei capacity = std::max(num, 2 * m_capacity);
+	glBindVertexArray(GetVao());
+	for (std::size_t i = 0; i < m_instanceBuffers.size(); ++i) {
+		GLuint grown;
+		glGenBuffers(1, &grown);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, GetInstanceStride(i) * capacity, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, m_instanceBuffers[i]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GetInstanceStride(i) * m_capacity);
+		glDeleteBuffers(1, &m_instanceBuffers[i]);
+		m_instanceBuffers[i] = grown;
+		glBindBuffer(GL_ARRAY_BUFFER, grown);
+		AttachInstanceBuffer(i);
+	}
+	glBindVertexArray(0);
+	m_capacity = capacity;
+}
+
+
+void InstancedVertexMesh::UpdateInstances(int attrib, GLsizei first, GLsizei count, const void* data)
+{
+	GLsizeiptr stride = GetInstanceStride(attrib);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffers[attrib]);
+	glBufferSubData(GL_ARRAY_BUFFER, stride * first, stride * count, data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void InstancedVertexMesh::WriteInstances(int attrib, GLsizei count, const void* data)
+{
+	GLsizeiptr stride = GetInstanceStride(attrib);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffers[attrib]);
+	glBufferData(GL_ARRAY_BUFFER, stride * m_capacity, nullptr, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, stride * count, data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+// Points the attribute at the buffer bound to GL_ARRAY_BUFFER, with the vertex array bound
+void InstancedVertexMesh::AttachInstanceBuffer(std::size_t attrib)
+{
+	AttachAttribute(m_instanceAttribs[attrib], 0);
+	glVertexAttribDivisor(m_instanceAttribs[attrib].index, 1);
+}
+
+
+GLsizeiptr InstancedVertexMesh::GetInstanceStride(std::size_t attrib) const
+{
+	const VertexAttribute& layout = m_instanceAttribs[attrib];
+	return layout.attribSize * GetTypeSize(layout.type);
+}
@@ -0,0 +1,80 @@
+// Noah Rubin
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <Windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) :
+	m_data(nullptr),
+	m_size(0),
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr)
+{
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+		return;
+	}
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping) {
+		m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		m_size = m_data ? (std::size_t) size.QuadPart : 0;
+	}
+}
+
+
+MappedFile::~MappedFile()
+{
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+	}
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+	}
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) :
+	m_data(nullptr),
+	m_size(0)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0) {
+		return;
+	}
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		void* data = mmap(nullptr, (std::size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, (std::size_t) info.st_size, MADV_SEQUENTIAL);
+			m_data = data;
+			m_size = (std::size_t) info.st_size;
+		}
+	}
+	close(fd);
+}
+
+
+MappedFile::~MappedFile()
+{
+	if (m_data) {
+		munmap(const_cast<void*>(m_data), m_size);
+	}
+}
+
+#endif
@@ -0,0 +1,48 @@
+// Noah Rubin
+
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+#include "Build.h"
+
+// Read-only view of a whole file. GetData returns nullptr if the file is missing or empty.
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+
+	MappedFile(const MappedFile& copy) = delete;
+
+	MappedFile& operator=(const MappedFile& copy) = delete;
+
+	~MappedFile();
+
+	const void* GetData() const;
+
+	std::size_t GetSize() const;
+
+private:
+	const void* m_data;
+	std::size_t m_size;
+#ifdef _WIN32
+	void* m_file;		// HANDLEs, kept as void* so that Windows.h stays out of this header
+	void* m_mapping;
+#endif
+};
+
+
+inline const void* MappedFile::GetData() const
+{
+	return m_data;
+}
+
+
+inline std::size_t MappedFile::GetSize() const
+{
+	return m_size;
+}
+
+#endif // !MAPPED_FILE_H_INCLUDED
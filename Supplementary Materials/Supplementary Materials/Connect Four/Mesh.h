@@ -5,63 +5,101 @@
 
 #include "Libraries/gl/glew.h"
 
-#include <vector>
+#include <cstddef>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
-union AttributeData
-{
-	AttributeData();
-	explicit AttributeData(GLfloat f);
-	explicit AttributeData(GLint i);
-	explicit AttributeData(GLuint ui);
-	explicit AttributeData(GLshort s);
-	explicit AttributeData(GLushort us);
-	explicit AttributeData(GLbyte b);
-	explicit AttributeData(GLubyte ub);
-
-	GLfloat fVal;
-	GLint iVal;
-	GLuint uiVal;
-	GLshort sVal;
-	GLushort usVal;
-	GLbyte bVal;
-	GLubyte ubVal;
+/*
+	Vertices are plain structs that are uploaded as they are, with all the attributes of a
+	vertex next to each other in one buffer. VERTEX_ATTRIBUTE works out the number, type and
+	offset of the components of a member at compile time, and a VertexLayout ties the
+	attributes to the vertex struct they were written for, so the two can't drift apart.
+*/
+
+// One shader input, read from every stride bytes of a buffer starting at offset
+struct VertexAttribute
+{
+	GLuint index;
+	GLint attribSize;		// number of components
+	GLenum type;
+	bool normalized;
+	GLsizei offset;			// bytes from the start of the vertex
 };
 
 
-struct VertexAttribute
+// Number and type of the components of a vertex member, a single value or an array of them
+template<class T>
+struct VertexComponents;
+
+#define VERTEX_COMPONENTS_HELPER(cType, glType)	\
+	template<>	\
+	struct VertexComponents<cType>	\
+	{	\
+		static constexpr GLint SIZE = 1;	\
+		static constexpr GLenum TYPE = glType;	\
+	};
+
+VERTEX_COMPONENTS_HELPER(GLbyte, GL_BYTE)
+VERTEX_COMPONENTS_HELPER(GLubyte, GL_UNSIGNED_BYTE)
+VERTEX_COMPONENTS_HELPER(GLshort, GL_SHORT)
+VERTEX_COMPONENTS_HELPER(GLushort, GL_UNSIGNED_SHORT)
+VERTEX_COMPONENTS_HELPER(GLint, GL_INT)
+VERTEX_COMPONENTS_HELPER(GLuint, GL_UNSIGNED_INT)
+VERTEX_COMPONENTS_HELPER(GLfloat, GL_FLOAT)
+
+#undef VERTEX_COMPONENTS_HELPER
+
+template<class T, std::size_t N>
+struct VertexComponents<T[N]>
 {
-	VertexAttribute();
+	static constexpr GLint SIZE = (GLint) N;
+	static constexpr GLenum TYPE = VertexComponents<T>::TYPE;
+};
 
-	VertexAttribute(
-		GLuint index,
-		GLint attribSize,
-		GLenum type,
-		bool normalized = false
-		);
 
-	VertexAttribute(
-		const std::vector<AttributeData>& data,
-		GLuint index,
-		GLint attribSize,
-		GLenum type,
-		bool normalized = false
-		);
+template<class Member>
+constexpr VertexAttribute MakeVertexAttribute(GLuint index, GLsizei offset = 0, bool normalized = false)
+{
+	return VertexAttribute { index, VertexComponents<Member>::SIZE, VertexComponents<Member>::TYPE, normalized, offset };
+}
 
-	std::vector<AttributeData> data;
-	GLuint index;
-	GLint attribSize;
-	GLenum type;
-	bool normalized;
+// Attribute index read from member of the vertex struct Vertex
+#define VERTEX_ATTRIBUTE(Vertex, member, index)	\
+	MakeVertexAttribute<decltype(Vertex::member)>(index, (GLsizei) offsetof(Vertex, member))
 
-	template<class T>
-	void AddData(T* data, int size);
 
-	template<class T>
-	void AddData(const std::vector<T>& data);
+// Attributes read from one buffer of elements stride bytes long
+struct AttributeLayout
+{
+	const VertexAttribute* attribs;
+	int numAttribs;
+	GLsizei stride;
 };
 
 
+// Layout of a buffer of Vertex structs. The attributes have to outlive the layout.
+template<class Vertex>
+struct VertexLayout : AttributeLayout
+{
+	static_assert(std::is_standard_layout<Vertex>::value, "offsetof needs a standard layout vertex");
+
+	template<std::size_t N>
+	explicit VertexLayout(const VertexAttribute (&attributes)[N]) :
+		AttributeLayout { attributes, (int) N, (GLsizei) sizeof(Vertex) }
+	{
+	}
+};
+
+
+struct PositionVertex
+{
+	GLfloat position[3];
+};
+
+constexpr VertexAttribute POSITION_VERTEX_ATTRIBS[] { VERTEX_ATTRIBUTE(PositionVertex, position, 0) };
+
+
 class IMesh
 {
 public:
@@ -71,10 +109,12 @@ public:
 };
 
 
+// Keeps its vertices in a single buffer, uploaded with one copy
 class VertexMesh : public IMesh
 {
 public:
-	VertexMesh(const std::vector<VertexAttribute>& attribs, GLenum primitive);
+	template<class Vertex>
+	VertexMesh(const std::vector<Vertex>& vertices, const VertexLayout<Vertex>& layout, GLenum primitive);
 
 	VertexMesh(const VertexMesh& copy) = delete;
 
@@ -89,14 +129,18 @@ public:
 	virtual void Render() const override;
 
 protected:
+	// Draws numVerts vertices, or indices for meshes that add an index buffer, and leaves
+	// the vertex array bound unless unbind
 	VertexMesh(
-		const std::vector<VertexAttribute>& attribs,
+		const void* vertices,
+		GLsizei numVertices,
+		const AttributeLayout& layout,
 		GLenum primitive,
 		GLsizei numVerts,
 		bool unbind
 		);
 
-	const std::vector<GLuint>& GetAttribBuffers() const;
+	GLuint GetVertexBuffer() const;
 
 	GLuint GetVao() const;
 
@@ -105,7 +149,7 @@ protected:
 	GLuint GetNumVerts() const;
 
 private:
-	std::vector<GLuint> m_attribBuffers;
+	GLuint m_vertexBuffer;
 	GLuint m_vao;
 	GLenum m_primitive;
 	GLsizei m_numVerts;
@@ -115,8 +159,10 @@ private:
 class IndexedMesh : public VertexMesh
 {
 public:
+	template<class Vertex>
 	IndexedMesh(
-		const std::vector<VertexAttribute>& attribs,
+		const std::vector<Vertex>& vertices,
+		const VertexLayout<Vertex>& layout,
 		const std::vector<GLushort>& indices,
 		GLenum primitive
 	);
@@ -133,15 +179,9 @@ protected:
 	GLuint GetNumIndices() const;
 
 	IndexedMesh(
-		const std::vector<VertexAttribute>& attribs,
-		const std::vector<GLushort>& indices,
-		GLenum primitive,
-		bool unbind,
-		GLsizei numVerts
-		);
-
-	IndexedMesh(
-		const std::vector<VertexAttribute>& attribs,
+		const void* vertices,
+		GLsizei numVertices,
+		const AttributeLayout& layout,
 		const std::vector<GLushort>& indices,
 		GLenum primitive,
 		bool unbind
@@ -152,27 +192,78 @@ private:
 };
 
 
+// Draws the same vertices once per instance. Attributes that differ between instances,
+// such as where each copy goes, live in dynamic buffers of their own that advance once per
+// instance (glVertexAttribDivisor), so their number is only limited by memory and changing
+// one instance only writes that instance's values.
 class InstancedVertexMesh : public VertexMesh
 {
 public:
+	template<class Vertex>
 	InstancedVertexMesh(
-		const std::vector<VertexAttribute>& attribs,
+		const std::vector<Vertex>& vertices,
+		const VertexLayout<Vertex>& layout,
 		GLenum primitive,
 		GLsizei numInstances
 	);
 
+	// Each of instanceAttribs gets a buffer with room for numInstances tightly packed
+	// values, which are written with WriteInstances and UpdateInstances. Their offsets
+	// are ignored.
+	template<class Vertex>
+	InstancedVertexMesh(
+		const std::vector<Vertex>& vertices,
+		const VertexLayout<Vertex>& layout,
+		const std::vector<VertexAttribute>& instanceAttribs,
+		GLenum primitive,
+		GLsizei numInstances
+	);
+
+	InstancedVertexMesh(InstancedVertexMesh&& move);
+
+	InstancedVertexMesh& operator=(InstancedVertexMesh&& move);
+
+	virtual ~InstancedVertexMesh();
+
 	virtual void Render() const override;
 
+	// Grows the instance buffers if num instances don't fit, keeping what they hold
 	void SetInstances(GLsizei num);
 
+	// Overwrites count values of instance attribute attrib from instance first on. data
+	// holds them packed, in the type of the attribute.
+	void UpdateInstances(int attrib, GLsizei first, GLsizei count, const void* data);
+
+	// Replaces the values of instance attribute attrib with count new ones and leaves any
+	// after them undefined. The old storage is orphaned, so the write doesn't wait for
+	// draws that still read it.
+	void WriteInstances(int attrib, GLsizei count, const void* data);
+
+protected:
+	InstancedVertexMesh(
+		const void* vertices,
+		GLsizei numVertices,
+		const AttributeLayout& layout,
+		const std::vector<VertexAttribute>& instanceAttribs,
+		GLenum primitive,
+		GLsizei numInstances
+	);
+
 private:
+	std::vector<VertexAttribute> m_instanceAttribs;
+	std::vector<GLuint> m_instanceBuffers;
 	GLsizei m_numInstances;
+	GLsizei m_capacity;				// instances the buffers have room for
+
+	void AttachInstanceBuffer(std::size_t attrib);
+
+	GLsizeiptr GetInstanceStride(std::size_t attrib) const;
 };
 
 
-inline const std::vector<GLuint>& VertexMesh::GetAttribBuffers() const
+inline GLuint VertexMesh::GetVertexBuffer() const
 {
-	return m_attribBuffers;
+	return m_vertexBuffer;
 }
 
 
@@ -200,24 +291,47 @@ inline GLuint IndexedMesh::GetNumIndices() const
 }
 
 
-inline void InstancedVertexMesh::SetInstances(GLsizei num)
+template<class Vertex>
+inline VertexMesh::VertexMesh(const std::vector<Vertex>& vertices, const VertexLayout<Vertex>& layout, GLenum primitive) :
+	VertexMesh(vertices.data(), (GLsizei) vertices.size(), layout, primitive, (GLsizei) vertices.size(), true)
 {
-	m_numInstances = num;
 }
 
 
-template<class T>
-inline void VertexAttribute::AddData(T* dat, int size)
+template<class Vertex>
+inline IndexedMesh::IndexedMesh(
+	const std::vector<Vertex>& vertices,
+	const VertexLayout<Vertex>& layout,
+	const std::vector<GLushort>& indices,
+	GLenum primitive
+	) :
+	IndexedMesh(vertices.data(), (GLsizei) vertices.size(), layout, indices, primitive, true)
 {
-	for (T* it = dat; it != dat + size; ++it) {
-		data.push_back(AttributeData(*it));
-	}
 }
 
-template<class T>
-inline void VertexAttribute::AddData(const std::vector<T>& dat)
+
+template<class Vertex>
+inline InstancedVertexMesh::InstancedVertexMesh(
+	const std::vector<Vertex>& vertices,
+	const VertexLayout<Vertex>& layout,
+	GLenum primitive,
+	GLsizei numInstances
+	) :
+	InstancedVertexMesh(vertices.data(), (GLsizei) vertices.size(), layout, std::vector<VertexAttribute>(), primitive, numInstances)
+{
+}
+
+
+template<class Vertex>
+inline InstancedVertexMesh::InstancedVertexMesh(
+	const std::vector<Vertex>& vertices,
+	const VertexLayout<Vertex>& layout,
+	const std::vector<VertexAttribute>& instanceAttribs,
+	GLenum primitive,
+	GLsizei numInstances
+	) :
+	InstancedVertexMesh(vertices.data(), (GLsizei) vertices.size(), layout, instanceAttribs, primitive, numInstances)
 {
-	data.insert(data.end(), dat.begin(), dat.end());
 }
 
 #endif // !MESH_H_INCLUDED
@@ -0,0 +1,356 @@
+// Noah Rubin
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "MonteCarloSearch.h"
+
+
+namespace
+{
+	constexpr int NO_CHILDREN = -1;
+	constexpr int EXPANDING = -2;			// also left in place when the arena had no room for the children
+	constexpr int CHECK_INTERVAL = 16;		// simulations between looks at the clock
+	constexpr double DEFAULT_SECONDS = 1.0;
+	constexpr std::size_t DEFAULT_SIZE_MB = 64;
+	constexpr double EXPLORATION = 1.0;
+	constexpr unsigned int VIRTUAL_LOSS = 3;
+	constexpr Board::Bitboard COLUMN_CELLS = 0x010101010101ULL;
+	constexpr int moveOrdering[] { 3, 4, 2, 5, 1, 6, 0 };
+}
+
+
+MonteCarloSearch::Options::Options() :
+	seconds(DEFAULT_SECONDS),
+	threads(0),
+	sizeMB(DEFAULT_SIZE_MB),
+	exploration(EXPLORATION),
+	virtualLoss(VIRTUAL_LOSS),
+	threatRollouts(true),
+	seed(1)
+{
+}
+
+
+MonteCarloSearch::Result::Result() :
+	column(-1),
+	score(0),
+	simulations(0),
+	principalVariation()
+{
+}
+
+
+MonteCarloSearch::MonteCarloSearch(const Options& options) :
+	m_options(options),
+	m_nodes(),
+	m_capacity(std::max<std::size_t>(Board::WIDTH + 1, options.sizeMB * 1024 * 1024 / sizeof(Node))),
+	m_used(0),
+	m_root(-1),
+	m_rootBoard(),
+	m_simulations(0),
+	m_searches(0)
+{
+	m_nodes.reset(new Node[m_capacity]);
+}
+
+
+MonteCarloSearch::Result MonteCarloSearch::Search(const Board& board, const std::atomic<bool>& stop)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(m_options.seconds);
+	if (board.GetWinner() != CHIP_NONE || board.IsBoardFull()) {
+		return Result();
+	}
+
+	// keep what is known about board from the last search if there is still room to add to it
+	int root = FindRoot(board);
+	m_root = -1;
+	if (root < 0 || m_nodes[root].firstChild == EXPANDING || m_used >= m_capacity / 4 * 3) {
+		m_used = 0;
+		root = NewNode(0, TERMINAL_NONE);
+	}
+	m_rootBoard = board;
+	if (m_nodes[root].firstChild == NO_CHILDREN) {
+		Expand(m_nodes[root], board);
+	}
+	m_simulations = 0;
+	m_root = root;
+	++m_searches;
+
+	auto work = [this, &stop, deadline](unsigned int thread)
+	{
+		std::seed_seq seed { m_options.seed, m_searches, thread };
+		std::mt19937 rng(seed);
+		do {
+			for (int i = 0; i < CHECK_INTERVAL; ++i) {
+				Simulate(rng);
+			}
+			m_simulations += CHECK_INTERVAL;
+		} while (!stop && std::chrono::steady_clock::now() < deadline);
+	};
+
+	// with a single legal move there is nothing to decide
+	if (m_nodes[root].numChildren > 1) {
+		unsigned int numThreads = m_options.threads;
+		if (numThreads == 0) {
+			numThreads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		std::vector<std::thread> helpers;
+		for (unsigned int t = 1; t < numThreads; ++t) {
+			helpers.emplace_back(work, t);
+		}
+		work(0);
+		for (std::thread& helper : helpers) {
+			helper.join();
+		}
+	}
+	Result result = GetProgress();
+	if (result.column == -1) {
+		result.column = m_nodes[m_nodes[root].firstChild].column;
+		result.principalVariation.push_back(result.column);
+	}
+	return result;
+}
+
+
+MonteCarloSearch::Result MonteCarloSearch::GetProgress() const
+{
+	Result result;
+	result.simulations = m_simulations;
+	int root = m_root;
+	int best = (root < 0 ? -1 : MostVisitedChild(m_nodes[root]));
+	if (best < 0) {
+		return result;
+	}
+	const Node& node = m_nodes[best];
+	unsigned int visits = node.visits;
+	result.column = node.column;
+	result.score = (int) ((long long) node.score * 1000 / std::max(1u, visits)) - 1000;
+	for (int i = best; i >= 0; i = MostVisitedChild(m_nodes[i])) {
+		result.principalVariation.push_back(m_nodes[i].column);
+	}
+	return result;
+}
+
+
+void MonteCarloSearch::Clear()
+{
+	m_root = -1;
+	m_used = 0;
+}
+
+
+std::size_t MonteCarloSearch::GetSizeBytes() const
+{
+	return m_capacity * sizeof(Node);
+}
+
+
+// Walks down the tree to a leaf, plays a game out from there and counts its result in every
+// node on the way
+void MonteCarloSearch::Simulate(std::mt19937& rng)
+{
+	int path[Board::WIDTH * Board::HEIGHT + 1];
+	int length = 0;
+	Board board(m_rootBoard);
+	int index = m_root;
+	bool expanded = false;
+	while (true) {
+		Node& node = m_nodes[index];
+		node.visits.fetch_add(m_options.virtualLoss, std::memory_order_relaxed);
+		path[length++] = index;
+		if (node.terminal != TERMINAL_NONE || expanded) {
+			break;
+		}
+		int first = node.firstChild.load(std::memory_order_acquire);
+		if (first == NO_CHILDREN) {
+			first = Expand(node, board);
+			expanded = true;
+		}
+		if (first < 0) {
+			break;
+		}
+		index = SelectChild(node);
+		board.Drop(m_nodes[index].column);
+	}
+
+	Chip winner;
+	switch (m_nodes[index].terminal) {
+	case TERMINAL_WIN:
+		winner = board.GetNextTurn();
+		break;
+	case TERMINAL_DRAW:
+		winner = CHIP_NONE;
+		break;
+	default:
+		winner = Rollout(board, rng);
+		break;
+	}
+
+	Chip mover = m_rootBoard.GetNextTurn();
+	for (int i = 0; i < length; ++i) {
+		Node& node = m_nodes[path[i]];
+		node.score.fetch_add(winner == CHIP_NONE ? 1 : winner == mover ? 2 : 0, std::memory_order_relaxed);
+		// wraps around to take the virtual loss back off
+		node.visits.fetch_add(1u - m_options.virtualLoss, std::memory_order_relaxed);
+		mover = (mover == CHIP_BLACK ? CHIP_RED : CHIP_BLACK);
+	}
+}
+
+
+int MonteCarloSearch::SelectChild(const Node& node) const
+{
+	int first = node.firstChild.load(std::memory_order_acquire);
+	double logVisits = std::log(node.visits.load(std::memory_order_relaxed) + 1.0);
+	int best = first;
+	double bestValue = -1.0;
+	for (int i = first; i < first + node.numChildren; ++i) {
+		const Node& child = m_nodes[i];
+		if (child.terminal == TERMINAL_WIN) {
+			return i;
+		}
+		unsigned int visits = child.visits.load(std::memory_order_relaxed);
+		if (visits == 0) {
+			return i;		// children are in move ordering order, so the centre is tried first
+		}
+		double value = child.score.load(std::memory_order_relaxed) / (2.0 * visits)
+			+ m_options.exploration * std::sqrt(logVisits / visits);
+		if (value > bestValue) {
+			bestValue = value;
+			best = i;
+		}
+	}
+	return best;
+}
+
+
+// Creates the children of node and returns the index of the first, or -1 if another thread
+// got there first or the arena is full
+int MonteCarloSearch::Expand(Node& node, const Board& board)
+{
+	int expected = NO_CHILDREN;
+	if (!node.firstChild.compare_exchange_strong(expected, EXPANDING)) {
+		return -1;
+	}
+	int columns[Board::WIDTH];
+	int count = 0;
+	for (int col : moveOrdering) {
+		if (!board.IsColumnFull(col)) {
+			columns[count++] = col;
+		}
+	}
+	std::size_t first = m_used.fetch_add(count);
+	if (first + count > m_capacity) {
+		return -1;
+	}
+	for (int i = 0; i < count; ++i) {
+		Board child(board);
+		Terminal terminal = child.Play(columns[i]) ? TERMINAL_WIN : child.IsBoardFull() ? TERMINAL_DRAW : TERMINAL_NONE;
+		InitNode(m_nodes[first + i], columns[i], terminal);
+	}
+	node.numChildren = (unsigned char) count;
+	node.firstChild.store((int) first, std::memory_order_release);
+	return (int) first;
+}
+
+
+// Plays random moves until the game ends and returns the winner. With threat rollouts
+// a player who can win does, one who has to block does, and no one plays under a cell
+// the opponent wins with unless there is nothing else to play.
+Chip MonteCarloSearch::Rollout(Board board, std::mt19937& rng) const
+{
+	while (board.GetWinner() == CHIP_NONE && !board.IsBoardFull()) {
+		Board::Bitboard moves = board.GetPlayableMoves();
+		if (m_options.threatRollouts) {
+			if (board.GetThreats(board.GetThisTurn()) & moves) {
+				return board.GetThisTurn();
+			}
+			Board::Bitboard threats = board.GetThreats(board.GetNextTurn());
+			if (threats & moves) {
+				moves &= threats;
+			}
+			else if (moves & ~(threats << 8ULL)) {
+				moves &= ~(threats << 8ULL);
+			}
+		}
+		int columns[Board::WIDTH];
+		int count = 0;
+		for (int col = 0; col < Board::WIDTH; ++col) {
+			if (moves & (COLUMN_CELLS << col)) {
+				columns[count++] = col;
+			}
+		}
+		board.Drop(columns[rng() % count]);
+	}
+	return board.GetWinner();
+}
+
+
+// Returns the node of board if it is the last root or up to two moves below it, otherwise -1
+int MonteCarloSearch::FindRoot(const Board& board) const
+{
+	int root = m_root;
+	if (root < 0) {
+		return -1;
+	}
+	if (m_rootBoard == board) {
+		return root;
+	}
+	const Node& node = m_nodes[root];
+	for (int i = node.firstChild; i >= 0 && i < node.firstChild + node.numChildren; ++i) {
+		Board child(m_rootBoard);
+		child.Drop(m_nodes[i].column);
+		if (child == board) {
+			return i;
+		}
+		const Node& childNode = m_nodes[i];
+		for (int j = childNode.firstChild; j >= 0 && j < childNode.firstChild + childNode.numChildren; ++j) {
+			Board grandchild(child);
+			grandchild.Drop(m_nodes[j].column);
+			if (grandchild == board) {
+				return j;
+			}
+		}
+	}
+	return -1;
+}
+
+
+int MonteCarloSearch::NewNode(int column, Terminal terminal)
+{
+	int index = (int) m_used.fetch_add(1);
+	InitNode(m_nodes[index], column, terminal);
+	return index;
+}
+
+
+void MonteCarloSearch::InitNode(Node& node, int column, Terminal terminal)
+{
+	node.visits.store(0, std::memory_order_relaxed);
+	node.score.store(0, std::memory_order_relaxed);
+	node.firstChild.store(NO_CHILDREN, std::memory_order_relaxed);
+	node.numChildren = 0;
+	node.column = (unsigned char) column;
+	node.terminal = terminal;
+}
+
+
+int MonteCarloSearch::MostVisitedChild(const Node& node) const
+{
+	int first = node.firstChild.load(std::memory_order_acquire);
+	if (first < 0) {
+		return -1;
+	}
+	int best = -1;
+	unsigned int bestVisits = 0;
+	for (int i = first; i < first + node.numChildren; ++i) {
+		unsigned int visits = m_nodes[i].visits.load(std::memory_order_relaxed);
+		if (visits > bestVisits) {
+			bestVisits = visits;
+			best = i;
+		}
+	}
+	return best;
+}
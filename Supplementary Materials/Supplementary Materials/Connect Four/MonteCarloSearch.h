@@ -0,0 +1,113 @@
+// Noah Rubin
+
+#ifndef MONTE_CARLO_SEARCH_H_INCLUDED
+#define MONTE_CARLO_SEARCH_H_INCLUDED
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <random>
+
+#include "Build.h"
+#include "Board.h"
+
+/*
+	Monte Carlo tree search for when a move has to be ready by a deadline. It plays games
+	to the end from the leaves of a tree that grows towards the moves that have scored best
+	so far (UCT), so it always has a best move and keeps improving it until the time is up
+	or it is stopped.
+
+	All of the threads work on one tree. A thread adds a virtual loss to every node it
+	passes through on the way down and takes it back once it knows the result, so the
+	others spread out over different lines instead of all following the same one.
+
+	Nodes come from an arena of fixed size that is allocated once. When the next search
+	starts from a position up to two moves below the last root, the subtree under it is
+	kept, and the arena is only emptied once three quarters of it are in use.
+*/
+class MonteCarloSearch
+{
+public:
+	struct Options
+	{
+		Options();
+
+		double seconds;				// time budget of a search
+		unsigned int threads;		// 0 for one per hardware thread
+		std::size_t sizeMB;			// memory for the node arena
+		double exploration;			// UCT exploration constant
+		unsigned int virtualLoss;	// lost games a thread adds to each node it is searching below
+		bool threatRollouts;		// rollouts take wins and block the opponent's instead of playing at random
+		unsigned int seed;
+	};
+
+	struct Result
+	{
+		Result();
+
+		int column;
+		int score;							// expected result for the player to move, from -1000 for a loss to 1000 for a win
+		unsigned long long simulations;
+		std::vector<int> principalVariation;	// most visited line starting with column
+	};
+
+	explicit MonteCarloSearch(const Options& options);
+
+	MonteCarloSearch(const MonteCarloSearch& copy) = delete;
+
+	MonteCarloSearch& operator=(const MonteCarloSearch& copy) = delete;
+
+	// Searches until the time budget is used up or stop is set
+	Result Search(const Board& board, const std::atomic<bool>& stop);
+
+	// Best move of the running search so far, safe to call from another thread
+	Result GetProgress() const;
+
+	void Clear();
+
+	std::size_t GetSizeBytes() const;
+
+private:
+	enum Terminal : unsigned char
+	{
+		TERMINAL_NONE, TERMINAL_WIN, TERMINAL_DRAW
+	};
+
+	struct Node
+	{
+		std::atomic<unsigned int> visits;
+		std::atomic<unsigned int> score;		// two per win and one per draw for the player who moved into this node
+		std::atomic<int> firstChild;			// arena index of the children, or NO_CHILDREN or EXPANDING
+		unsigned char numChildren;
+		unsigned char column;					// move that leads to this node
+		Terminal terminal;						// whether that move ended the game
+	};
+
+	Options m_options;
+	std::unique_ptr<Node[]> m_nodes;
+	std::size_t m_capacity;
+	std::atomic<std::size_t> m_used;
+	std::atomic<int> m_root;					// -1 while a search is being set up
+	Board m_rootBoard;
+	std::atomic<unsigned long long> m_simulations;
+	unsigned int m_searches;
+
+	void Simulate(std::mt19937& rng);
+
+	int SelectChild(const Node& node) const;
+
+	int Expand(Node& node, const Board& board);
+
+	Chip Rollout(Board board, std::mt19937& rng) const;
+
+	int FindRoot(const Board& board) const;
+
+	int NewNode(int column, Terminal terminal);
+
+	void InitNode(Node& node, int column, Terminal terminal);
+
+	int MostVisitedChild(const Node& node) const;
+};
+
+#endif // !MONTE_CARLO_SEARCH_H_INCLUDED
@@ -0,0 +1,294 @@
+// Noah Rubin
+
+#include <algorithm>
+
+#include "ProofNumberSearch.h"
+
+/*
+	Every node keeps its numbers from the point of view of the player to move, so that one
+	search function serves both sides: phi is the cost of proving that the player to move
+	reaches his goal and delta the cost of disproving it. The attacker's goal is to win,
+	the defender's is not to lose. A node's phi is the smallest delta of its children and
+	its delta the sum of their phis.
+
+	Expanding a node first looks for moves that decide the game at once: a move that wins
+	ends the search there, two winning cells for the opponent can't both be blocked, a
+	single one has to be, and a move under a cell the opponent wins with loses.
+*/
+
+
+namespace
+{
+	constexpr unsigned int INFINITE = 0x3FFFFFFF;
+	constexpr std::size_t DEFAULT_SIZE_MB = 64;
+	constexpr int moveOrdering[] { 3, 4, 2, 5, 1, 6, 0 };
+
+
+	unsigned int Add(unsigned int a, unsigned int b)
+	{
+		return std::min(a + b, INFINITE);
+	}
+}
+
+
+ProofNumberSearch::Options::Options() :
+	sizeMB(DEFAULT_SIZE_MB),
+	maxNodes(0)
+{
+}
+
+
+ProofNumberSearch::ProofNumberSearch(const Options& options) :
+	m_options(options),
+	m_slots(),
+	m_attacker(CHIP_BLACK),
+	m_nodes(0),
+	m_totalNodes(0),
+	m_shift(0),
+	m_aborted(false)
+{
+	// a power of two number of slots, grouped in pairs
+	std::size_t slots = 2;
+	m_shift = 63;
+	while (slots * 2 * sizeof(Slot) <= std::max<std::size_t>(1, options.sizeMB) * 1024 * 1024) {
+		slots *= 2;
+		--m_shift;
+	}
+	m_slots.resize(slots);
+	Clear();
+}
+
+
+ProofNumberSearch::Result ProofNumberSearch::Prove(const Board& board, Chip attacker)
+{
+	m_attacker = attacker;
+	m_nodes = 0;
+	m_aborted = false;
+	unsigned int phi;
+	unsigned int delta;
+	Search(board, INFINITE, INFINITE, phi, delta);
+	m_totalNodes += m_nodes;
+	if (phi != 0 && delta != 0) {
+		return Result::UNKNOWN;
+	}
+	bool moverReachesGoal = (phi == 0);
+	return moverReachesGoal == (board.GetThisTurn() == attacker) ? Result::PROVEN : Result::DISPROVEN;
+}
+
+
+ProofNumberSearch::Outcome ProofNumberSearch::Solve(const Board& board)
+{
+	Result win = Prove(board, board.GetThisTurn());
+	if (win == Result::PROVEN) {
+		return Outcome::WIN;
+	}
+	if (win == Result::UNKNOWN) {
+		return Outcome::UNKNOWN;
+	}
+	switch (Prove(board, board.GetNextTurn())) {
+	case Result::PROVEN:
+		return Outcome::LOSS;
+	case Result::DISPROVEN:
+		return Outcome::DRAW;
+	default:
+		return Outcome::UNKNOWN;
+	}
+}
+
+
+int ProofNumberSearch::GetWinningMove(const Board& board)
+{
+	if (board.GetWinner() != CHIP_NONE) {
+		return -1;
+	}
+	Chip mover = board.GetThisTurn();
+	m_attacker = mover;
+	int candidates[Board::WIDTH];
+	unsigned int deltas[Board::WIDTH];
+	int numCandidates = 0;
+	for (int col : moveOrdering) {
+		if (board.IsColumnFull(col)) {
+			continue;
+		}
+		Board child(board);
+		if (child.Play(col)) {
+			return col;
+		}
+		unsigned int phi;
+		unsigned int delta;
+		Lookup(child, phi, delta);
+		if (phi == INFINITE) {
+			return col;
+		}
+		// the proof went through the child with the smallest delta, so that is the first one
+		// to prove again if the store has dropped it
+		int i = numCandidates++;
+		for (; i > 0 && deltas[i - 1] > delta; --i) {
+			candidates[i] = candidates[i - 1];
+			deltas[i] = deltas[i - 1];
+		}
+		candidates[i] = col;
+		deltas[i] = delta;
+	}
+	for (int i = 0; i < numCandidates; ++i) {
+		Board child(board);
+		child.Drop(candidates[i]);
+		if (deltas[i] != INFINITE && Prove(child, mover) == Result::PROVEN) {
+			return candidates[i];
+		}
+	}
+	return -1;
+}
+
+
+void ProofNumberSearch::Clear()
+{
+	Slot empty = { 0, 0, 1, 1, 0 };
+	std::fill(m_slots.begin(), m_slots.end(), empty);
+}
+
+
+void ProofNumberSearch::Search(const Board& node, unsigned int thresholdPhi, unsigned int thresholdDelta, unsigned int& phi, unsigned int& delta)
+{
+	unsigned long long start = m_nodes++;
+	if (m_options.maxNodes && m_nodes > m_options.maxNodes) {
+		m_aborted = true;
+	}
+	int children[Board::WIDTH];
+	int numChildren;
+	if (Evaluate(node, children, numChildren, phi, delta)) {
+		Store(node, phi, delta, 1);
+		return;
+	}
+	while (true) {
+		int best = 0;
+		unsigned int bestPhi = INFINITE;
+		unsigned int minDelta = INFINITE;
+		unsigned int secondDelta = INFINITE;
+		unsigned int sumPhi = 0;
+		for (int i = 0; i < numChildren; ++i) {
+			Board child(node);
+			child.Drop(children[i]);
+			unsigned int childPhi;
+			unsigned int childDelta;
+			Lookup(child, childPhi, childDelta);
+			sumPhi = Add(sumPhi, childPhi);
+			if (childDelta < minDelta) {
+				secondDelta = minDelta;
+				minDelta = childDelta;
+				bestPhi = childPhi;
+				best = i;
+			}
+			else if (childDelta < secondDelta) {
+				secondDelta = childDelta;
+			}
+		}
+		phi = minDelta;
+		delta = sumPhi;
+		if (phi >= thresholdPhi || delta >= thresholdDelta || m_aborted) {
+			break;
+		}
+		// the child may use up the slack in this node's delta, and keeps going until its
+		// delta passes the second best child's by a quarter (the 1 + epsilon trick)
+		unsigned int childThresholdPhi = Add(thresholdDelta - delta, bestPhi);
+		unsigned int childThresholdDelta = std::min(thresholdPhi, Add(secondDelta, secondDelta / 4 + 1));
+		Board child(node);
+		child.Drop(children[best]);
+		unsigned int childPhi;
+		unsigned int childDelta;
+		Search(child, childThresholdPhi, childThresholdDelta, childPhi, childDelta);
+	}
+	Store(node, phi, delta, m_nodes - start);
+}
+
+
+// Returns true if the numbers of node are known without looking at its children,
+// otherwise fills in the moves worth trying
+bool ProofNumberSearch::Evaluate(const Board& node, int (&children)[Board::WIDTH], int& numChildren, unsigned int& phi, unsigned int& delta) const
+{
+	Chip mover = node.GetThisTurn();
+	bool reachesGoal;
+	numChildren = 0;
+	if (node.GetWinner() != CHIP_NONE) {
+		reachesGoal = false;		// the opponent has just won
+	}
+	else if (node.IsBoardFull()) {
+		reachesGoal = (mover != m_attacker);
+	}
+	else {
+		Board::Bitboard playable = node.GetPlayableMoves();
+		Board::Bitboard opponentThreats = node.GetThreats(node.GetNextTurn());
+		Board::Bitboard forced = opponentThreats & playable;
+		if (node.GetThreats(mover) & playable) {
+			reachesGoal = true;
+		}
+		else if (forced & (forced - 1)) {
+			reachesGoal = false;
+		}
+		else {
+			Board::Bitboard moves = (forced ? forced : playable) & ~(opponentThreats << 8ULL);
+			for (int col : moveOrdering) {
+				if (moves & (Board::Bitboard(0x010101010101ULL) << col)) {
+					children[numChildren++] = col;
+				}
+			}
+			if (numChildren > 0) {
+				return false;
+			}
+			reachesGoal = false;	// every move lets the opponent win
+		}
+	}
+	phi = reachesGoal ? 0 : INFINITE;
+	delta = reachesGoal ? INFINITE : 0;
+	return true;
+}
+
+
+std::size_t ProofNumberSearch::Index(const Board& board, Board::Bitboard& key, unsigned int& keyHigh) const
+{
+	Board::Bitboard black = board.GetBitboard(CHIP_BLACK);
+	Board::Bitboard red = board.GetBitboard(CHIP_RED);
+	key = black | (red << 48);
+	// bit 47 of a board is never set, which leaves the top bit free for the attacker
+	keyHigh = (unsigned int) (red >> 16) | ((unsigned int) m_attacker << 31);
+	Board::Bitboard hash = (key ^ (keyHigh * 0xC2B2AE3D27D4EB4FULL)) * 0x9E3779B97F4A7C15ULL;
+	return (std::size_t) (hash >> m_shift) & ~std::size_t(1);
+}
+
+
+void ProofNumberSearch::Lookup(const Board& board, unsigned int& phi, unsigned int& delta) const
+{
+	Board::Bitboard key;
+	unsigned int keyHigh;
+	std::size_t index = Index(board, key, keyHigh);
+	for (std::size_t i = index; i < index + 2; ++i) {
+		const Slot& slot = m_slots[i];
+		if (slot.key == key && slot.keyHigh == keyHigh && slot.work > 0) {
+			phi = slot.phi;
+			delta = slot.delta;
+			return;
+		}
+	}
+	phi = 1;
+	delta = 1;
+}
+
+
+void ProofNumberSearch::Store(const Board& board, unsigned int phi, unsigned int delta, unsigned long long work)
+{
+	Board::Bitboard key;
+	unsigned int keyHigh;
+	std::size_t index = Index(board, key, keyHigh);
+	Slot* slot = &m_slots[index];
+	if (!(slot->key == key && slot->keyHigh == keyHigh)) {
+		Slot* other = &m_slots[index + 1];
+		if ((other->key == key && other->keyHigh == keyHigh) || other->work < slot->work) {
+			slot = other;
+		}
+	}
+	slot->key = key;
+	slot->keyHigh = keyHigh;
+	slot->phi = phi;
+	slot->delta = delta;
+	slot->work = (unsigned int) std::min<unsigned long long>(work, 0xFFFFFFFF);
+}
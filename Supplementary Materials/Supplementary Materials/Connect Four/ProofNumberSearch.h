@@ -0,0 +1,100 @@
+// Noah Rubin
+
+#ifndef PROOF_NUMBER_SEARCH_H_INCLUDED
+#define PROOF_NUMBER_SEARCH_H_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+#include "Build.h"
+#include "Board.h"
+
+/*
+	Depth-first proof-number search (df-pn) that proves or disproves that one player, the
+	attacker, can force a win. Instead of a fixed depth it grows the tree where the fewest
+	nodes are left to prove or disprove, so forcing lines with few replies are followed to
+	the end quickly. Unlike NegaScout it only tells wins from non-wins, not how many moves
+	a win takes.
+
+	Proof and disproof numbers are kept in a node store of fixed size that never grows
+	past the memory it was given. When two positions compete for a slot, the one that took
+	less work to evaluate is dropped and recomputed if it is needed again.
+*/
+class ProofNumberSearch
+{
+public:
+	enum class Result
+	{
+		PROVEN, DISPROVEN, UNKNOWN
+	};
+
+	// Best result the player to move can force
+	enum class Outcome
+	{
+		WIN, DRAW, LOSS, UNKNOWN
+	};
+
+	struct Options
+	{
+		Options();
+
+		std::size_t sizeMB;				// memory for the node store
+		unsigned long long maxNodes;	// nodes expanded before giving up with UNKNOWN, 0 for no limit
+	};
+
+	explicit ProofNumberSearch(const Options& options);
+
+	ProofNumberSearch(const ProofNumberSearch& copy) = delete;
+
+	ProofNumberSearch& operator=(const ProofNumberSearch& copy) = delete;
+
+	// Whether attacker can force a win from board
+	Result Prove(const Board& board, Chip attacker);
+
+	// Proves first whether the player to move wins, then whether the opponent does
+	Outcome Solve(const Board& board);
+
+	// After Prove returned PROVEN with the player to move as attacker, returns a winning
+	// column, otherwise -1
+	int GetWinningMove(const Board& board);
+
+	void Clear();
+
+	unsigned long long GetNodes() const;
+
+private:
+	struct Slot
+	{
+		Board::Bitboard key;
+		unsigned int keyHigh;
+		unsigned int phi;		// proof number for the player to move at this node
+		unsigned int delta;		// disproof number for the same player
+		unsigned int work;		// nodes expanded below this one, decides what gets replaced
+	};
+
+	Options m_options;
+	std::vector<Slot> m_slots;
+	Chip m_attacker;
+	unsigned long long m_nodes;		// expanded by the current call to Prove
+	unsigned long long m_totalNodes;
+	int m_shift;
+	bool m_aborted;
+
+	void Search(const Board& node, unsigned int thresholdPhi, unsigned int thresholdDelta, unsigned int& phi, unsigned int& delta);
+
+	bool Evaluate(const Board& node, int (&children)[Board::WIDTH], int& numChildren, unsigned int& phi, unsigned int& delta) const;
+
+	void Lookup(const Board& board, unsigned int& phi, unsigned int& delta) const;
+
+	void Store(const Board& board, unsigned int phi, unsigned int delta, unsigned long long work);
+
+	std::size_t Index(const Board& board, Board::Bitboard& key, unsigned int& keyHigh) const;
+};
+
+
+inline unsigned long long ProofNumberSearch::GetNodes() const
+{
+	return m_totalNodes;
+}
+
+#endif // !PROOF_NUMBER_SEARCH_H_INCLUDED
@@ -2,6 +2,7 @@
 
 #include "ResourceLoader.h"
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <unordered_map>
@@ -32,35 +33,26 @@ bool operator==(const VertexData& a, const VertexData& b)
 
 namespace
 {
-	void IndexBufferObject(
-		std::vector<AttributeData>& verts,
-		std::vector<AttributeData>& uvs,
-		std::vector<GLushort>& indices
-		)
+	void IndexBufferObject(std::vector<PositionVertex>& verts, std::vector<GLushort>& indices)
 	{
-		std::vector<AttributeData> outVerts;
-		std::vector<AttributeData> outUvs;
+		std::vector<PositionVertex> outVerts;
 		std::unordered_map<VertexData, GLushort> indexMap;
 		VertexData data;
-		int k = 0;
-		for (int i = 0, j = 0; i < verts.size(); i += 3, j += 2) {
-			data.vertices = (float*) &verts[i];
-			//data.uvs = (float*) &uvs[j];
-			data.uvs = 0;
+		data.uvs = 0;
+		for (const PositionVertex& vertex : verts) {
+			data.vertices = vertex.position;
 			auto it = indexMap.find(data);
 			if (it != indexMap.end()) {
-				indices.push_back(it->second); ++k;
+				indices.push_back(it->second);
 			}
 			else {
-				outVerts.insert(outVerts.end(), data.vertices, data.vertices + 3);
-				//outUvs.insert(outUvs.end(), data.uvs, data.uvs + 2);
-				GLushort newIndex = outVerts.size() / 3 - 1;
+				GLushort newIndex = (GLushort) outVerts.size();
+				outVerts.push_back(vertex);
 				indices.push_back(newIndex);
 				indexMap[data] = newIndex;
 			}
 		}
 		verts.swap(outVerts);
-		uvs.swap(outUvs);
 	}
 
 
@@ -178,8 +170,6 @@ namespace
 
 IndexedMesh MeshFromObjFile(const std::string& file)
 {
-	VertexAttribute verts(0, 3, GL_FLOAT);
-	VertexAttribute uvs(1, 2, GL_FLOAT);
 	std::ifstream dataStream(file);
 	std::vector<GLushort> indices;
 	std::vector<GLfloat> tempVerts;
@@ -202,14 +192,13 @@ IndexedMesh MeshFromObjFile(const std::string& file)
 			ReadObjFace(lineStream, vertIndices, uvIndices);
 		}
 	}
-	for (int i = 0; i < vertIndices.size(); ++i) {
-		verts.data.insert(verts.data.end(), &tempVerts[vertIndices[i] * 3], (&tempVerts[vertIndices[i] * 3]) + 3);
-	}
-	for (int i = 0; i < uvIndices.size(); ++i) {
-		uvs.data.insert(uvs.data.end(), &tempUvs[uvIndices[i] * 2], (&tempUvs[uvIndices[i] * 2]) + 2);
+	// texture coordinates are read but not used by any of the shaders
+	std::vector<PositionVertex> verts(vertIndices.size());
+	for (std::size_t i = 0; i < vertIndices.size(); ++i) {
+		std::copy_n(&tempVerts[vertIndices[i] * 3], 3, verts[i].position);
 	}
-	IndexBufferObject(verts.data, uvs.data, indices);
-	return IndexedMesh(std::vector<VertexAttribute> { verts }, indices, GL_TRIANGLES);
+	IndexBufferObject(verts, indices);
+	return IndexedMesh(verts, VertexLayout<PositionVertex>(POSITION_VERTEX_ATTRIBS), indices, GL_TRIANGLES);
 }
 
 
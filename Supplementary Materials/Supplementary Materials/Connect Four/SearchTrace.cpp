@@ -0,0 +1,178 @@
+// Noah Rubin
+
+#include "SearchTrace.h"
+
+#ifdef SEARCH_TRACE
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+
+namespace
+{
+	constexpr std::size_t SPANS_PER_THREAD = 1 << 16;		// 1.5 MB per thread
+	const char* const eventNames[] { "search", "proof", "root column", "analyze column", "ponder", "table flush", "lock wait" };
+
+
+	struct Span
+	{
+		long long start;		// nanoseconds since the program started
+		long long end;
+		int argument;
+		SearchTrace::Event event;
+	};
+
+	struct Buffer
+	{
+		explicit Buffer(int thread) :
+			thread(thread),
+			inUse(false),
+			recorded(0),
+			spans(SPANS_PER_THREAD)
+		{
+		}
+
+		int thread;						// row of the timeline
+		bool inUse;						// whether a running thread owns the buffer
+		unsigned long long recorded;	// spans recorded since the last Clear, the next one goes in slot recorded % SPANS_PER_THREAD
+		std::vector<Span> spans;
+	};
+
+
+	const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	std::mutex registryMutex;							// guards buffers and their inUse flags
+	std::vector<std::unique_ptr<Buffer>> buffers;
+
+
+	// The buffer of the calling thread, taken on its first span and given back when it exits
+	struct ThreadBuffer
+	{
+		ThreadBuffer() :
+			buffer(nullptr)
+		{
+		}
+
+		~ThreadBuffer()
+		{
+			if (buffer) {
+				std::lock_guard<std::mutex> lock(registryMutex);
+				buffer->inUse = false;
+			}
+		}
+
+		Buffer& Get()
+		{
+			if (!buffer) {
+				std::lock_guard<std::mutex> lock(registryMutex);
+				for (std::unique_ptr<Buffer>& free : buffers) {
+					if (!free->inUse) {
+						buffer = free.get();
+						break;
+					}
+				}
+				if (!buffer) {
+					buffers.emplace_back(new Buffer((int) buffers.size() + 1));
+					buffer = buffers.back().get();
+				}
+				buffer->inUse = true;
+			}
+			return *buffer;
+		}
+
+		Buffer* buffer;
+	};
+
+	thread_local ThreadBuffer threadBuffer;
+
+
+	long long Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+}
+
+
+SearchTrace::Scope::Scope(Event event, int argument) :
+	m_start(Now()),
+	m_argument(argument),
+	m_event(event)
+{
+}
+
+
+SearchTrace::Scope::~Scope()
+{
+	Buffer& buffer = threadBuffer.Get();
+	Span& span = buffer.spans[buffer.recorded++ % SPANS_PER_THREAD];
+	span.start = m_start;
+	span.end = Now();
+	span.argument = m_argument;
+	span.event = m_event;
+}
+
+
+std::unique_lock<std::mutex> SearchTrace::Lock(std::mutex& mutex, int argument)
+{
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		Scope wait(Event::LOCK_WAIT, argument);
+		lock.lock();
+	}
+	return lock;
+}
+
+
+// Every span becomes a complete event ("ph":"X") with times in microseconds, and every
+// buffer a thread with a name of its own
+bool SearchTrace::Export(const std::string& path)
+{
+	std::ofstream file(path, std::ios::trunc);
+	file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	std::lock_guard<std::mutex> lock(registryMutex);
+	bool first = true;
+	for (const std::unique_ptr<Buffer>& buffer : buffers) {
+		file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread
+			<< ",\"args\":{\"name\":\"search thread " << buffer->thread << "\"}}";
+		first = false;
+		unsigned long long count = std::min<unsigned long long>(buffer->recorded, SPANS_PER_THREAD);
+		for (unsigned long long i = buffer->recorded - count; i < buffer->recorded; ++i) {
+			const Span& span = buffer->spans[i % SPANS_PER_THREAD];
+			file << ",\n{\"name\":\"" << eventNames[(int) span.event];
+			if (span.argument >= 0) {
+				file << " " << span.argument;
+			}
+			file << "\",\"cat\":\"search\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread
+				<< ",\"ts\":" << span.start / 1000.0 << ",\"dur\":" << (span.end - span.start) / 1000.0
+				<< ",\"args\":{\"argument\":" << span.argument << "}}";
+		}
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return (bool) file;
+}
+
+
+void SearchTrace::Clear()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	for (std::unique_ptr<Buffer>& buffer : buffers) {
+		buffer->recorded = 0;
+	}
+}
+
+#else
+
+bool SearchTrace::Export(const std::string&)
+{
+	return false;
+}
+
+
+void SearchTrace::Clear()
+{
+}
+
+#endif
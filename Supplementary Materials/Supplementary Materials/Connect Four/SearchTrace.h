@@ -0,0 +1,79 @@
+// Noah Rubin
+
+#ifndef SEARCH_TRACE_H_INCLUDED
+#define SEARCH_TRACE_H_INCLUDED
+
+#include <mutex>
+#include <string>
+
+#include "Build.h"
+
+/*
+	Timeline of what the search threads spend their time on, for finding out why some root
+	columns take much longer than others and where threads wait on each other. Each thread
+	records spans into a ring buffer of its own, so recording takes no lock, and once a
+	buffer is full its oldest spans are overwritten. A buffer is handed on to the next
+	thread when its thread exits, so the threads of successive searches share the same few
+	rows of the timeline. Export writes the spans in the Chrome trace event format, which
+	chrome://tracing and Perfetto show as one row per thread.
+
+	Tracing is only compiled in when SEARCH_TRACE is defined for the whole build. Otherwise
+	the macros at the bottom expand to nothing, or to a plain lock, and Export writes nothing.
+*/
+class SearchTrace
+{
+public:
+	enum class Event : unsigned char
+	{
+		SEARCH,				// one search of the AI's move, the argument is its depth
+		PROOF,				// proof-number search for a forced win before the search
+		ROOT_COLUMN,		// search below one root column, the argument is the column
+		ANALYZE_COLUMN,		// null window, aspiration or full search of a column in AI::Analyze
+		PONDER,				// ponder search of one reply, the argument is the column
+		TABLE_FLUSH,		// merging the thread tables into the shared one or clearing them
+		LOCK_WAIT,			// waiting for a lock held by another thread, the argument is the lock
+	};
+
+	// Records a span on the calling thread from construction to destruction
+	class Scope
+	{
+	public:
+		Scope(Event event, int argument);
+
+		~Scope();
+
+		Scope(const Scope& copy) = delete;
+
+		Scope& operator=(const Scope& copy) = delete;
+
+	private:
+		long long m_start;
+		int m_argument;
+		Event m_event;
+	};
+
+	// Locks mutex, and records a LOCK_WAIT span if another thread held it
+	static std::unique_lock<std::mutex> Lock(std::mutex& mutex, int argument);
+
+	// Writes the spans recorded since the last Clear as Chrome trace JSON. Must not be called
+	// while a search is running. Returns false if tracing is compiled out or the file can't
+	// be written.
+	static bool Export(const std::string& path);
+
+	// Forgets every span recorded so far. Must not be called while a search is running.
+	static void Clear();
+};
+
+
+#ifdef SEARCH_TRACE
+#	define SEARCH_TRACE_CONCAT_HELPER(a, b) a##b
+#	define SEARCH_TRACE_CONCAT(a, b) SEARCH_TRACE_CONCAT_HELPER(a, b)
+#	define SEARCH_TRACE_SCOPE(event, argument) \
+		SearchTrace::Scope SEARCH_TRACE_CONCAT(searchTraceScope, __LINE__)(SearchTrace::Event::event, argument)
+#	define SEARCH_TRACE_LOCK(name, lockable, argument) std::unique_lock<std::mutex> name(SearchTrace::Lock(lockable, argument))
+#else
+#	define SEARCH_TRACE_SCOPE(event, argument) ((void) 0)
+#	define SEARCH_TRACE_LOCK(name, lockable, argument) std::lock_guard<std::mutex> name(lockable)
+#endif
+
+#endif // !SEARCH_TRACE_H_INCLUDED
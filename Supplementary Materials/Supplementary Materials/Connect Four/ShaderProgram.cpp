@@ -0,0 +1,166 @@
+// Noah Rubin
+
+#include "ShaderProgram.h"
+
+#include <utility>
+
+GLuint ShaderProgram::sm_current = 0;
+
+
+ShaderProgram::ShaderProgram() :
+	m_id(0),
+	m_uniforms(),
+	m_attributes()
+{
+}
+
+
+ShaderProgram::ShaderProgram(GLuint program) :
+	m_id(program),
+	m_uniforms(),
+	m_attributes()
+{
+	GLint count;
+	GLint maxLength;
+	GLint size;
+	GLenum type;
+	glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> name(maxLength + 1);
+	glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint i = 0; i < count; ++i) {
+		glGetActiveUniform(m_id, i, (GLsizei) name.size(), nullptr, &size, &type, name.data());
+		std::string uniform(name.data());
+		// arrays are reported as their first element, and uniforms in blocks have no location
+		std::size_t bracket = uniform.find('[');
+		if (bracket != std::string::npos) {
+			uniform.erase(bracket);
+		}
+		std::vector<GLint>& locations = m_uniforms[uniform];
+		locations.resize(size);
+		for (GLint element = 0; element < size; ++element) {
+			std::string elementName = (size > 1 ? uniform + "[" + std::to_string(element) + "]" : uniform);
+			locations[element] = glGetUniformLocation(m_id, elementName.c_str());
+		}
+	}
+
+	glGetProgramiv(m_id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	name.assign(maxLength + 1, 0);
+	glGetProgramiv(m_id, GL_ACTIVE_ATTRIBUTES, &count);
+	for (GLint i = 0; i < count; ++i) {
+		glGetActiveAttrib(m_id, i, (GLsizei) name.size(), nullptr, &size, &type, name.data());
+		m_attributes[name.data()] = glGetAttribLocation(m_id, name.data());
+	}
+}
+
+
+ShaderProgram::ShaderProgram(ShaderProgram&& move) :
+	m_id(move.m_id),
+	m_uniforms(std::move(move.m_uniforms)),
+	m_attributes(std::move(move.m_attributes))
+{
+	move.m_id = 0;
+}
+
+
+// The program this one held is deleted along with move
+ShaderProgram& ShaderProgram::operator=(ShaderProgram&& move)
+{
+	std::swap(m_id, move.m_id);
+	m_uniforms.swap(move.m_uniforms);
+	m_attributes.swap(move.m_attributes);
+	return *this;
+}
+
+
+ShaderProgram::~ShaderProgram()
+{
+	if (m_id) {
+		if (sm_current == m_id) {
+			glUseProgram(0);
+			sm_current = 0;
+		}
+		glDeleteProgram(m_id);
+	}
+}
+
+
+void ShaderProgram::Use() const
+{
+	if (sm_current != m_id) {
+		glUseProgram(m_id);
+		sm_current = m_id;
+	}
+}
+
+
+GLint ShaderProgram::GetUniform(const std::string& name, int element) const
+{
+	auto it = m_uniforms.find(name);
+	if (it == m_uniforms.end() || element < 0 || element >= (int) it->second.size()) {
+		return -1;
+	}
+	return it->second[element];
+}
+
+
+GLint ShaderProgram::GetAttribute(const std::string& name) const
+{
+	auto it = m_attributes.find(name);
+	return it == m_attributes.end() ? -1 : it->second;
+}
+
+
+void ShaderProgram::BindUniformBlock(const std::string& name, GLuint binding) const
+{
+	GLuint block = glGetUniformBlockIndex(m_id, name.c_str());
+	if (block != GL_INVALID_INDEX) {
+		glUniformBlockBinding(m_id, block, binding);
+	}
+}
+
+
+UniformBuffer::UniformBuffer() :
+	m_id(0)
+{
+}
+
+
+UniformBuffer::UniformBuffer(GLsizeiptr size, GLuint binding) :
+	m_id(0)
+{
+	glGenBuffers(1, &m_id);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, m_id);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+
+UniformBuffer::UniformBuffer(UniformBuffer&& move) :
+	m_id(move.m_id)
+{
+	move.m_id = 0;
+}
+
+
+UniformBuffer& UniformBuffer::operator=(UniformBuffer&& move)
+{
+	std::swap(m_id, move.m_id);
+	return *this;
+}
+
+
+UniformBuffer::~UniformBuffer()
+{
+	if (m_id) {
+		glDeleteBuffers(1, &m_id);
+	}
+}
+
+
+void UniformBuffer::Write(const void* data, GLsizeiptr size, GLintptr offset) const
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
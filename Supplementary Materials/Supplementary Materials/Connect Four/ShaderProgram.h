@@ -0,0 +1,95 @@
+// Noah Rubin
+
+#ifndef SHADER_PROGRAM_H_INCLUDED
+#define SHADER_PROGRAM_H_INCLUDED
+
+#include "Libraries/gl/glew.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+	A linked shader program that looks up the locations of all of its active uniforms and
+	attributes once, right after linking, so that setting a uniform never has to ask the
+	driver for a location by name. Elements of uniform arrays are looked up one by one,
+	since the driver doesn't promise that they follow each other.
+
+	Use only calls glUseProgram when another program is bound, so code that sets a uniform
+	can make sure its program is bound without costing a driver call every time.
+*/
+class ShaderProgram
+{
+public:
+	ShaderProgram();
+
+	// Takes ownership of a program that has already been linked
+	explicit ShaderProgram(GLuint program);
+
+	ShaderProgram(const ShaderProgram& copy) = delete;
+
+	ShaderProgram(ShaderProgram&& move);
+
+	ShaderProgram& operator=(const ShaderProgram& copy) = delete;
+
+	ShaderProgram& operator=(ShaderProgram&& move);
+
+	~ShaderProgram();
+
+	void Use() const;
+
+	// Location of element of the uniform array name, or of the uniform name itself when
+	// element is 0. Returns -1 if the program has no such active uniform.
+	GLint GetUniform(const std::string& name, int element = 0) const;
+
+	// Returns -1 if the program has no such active attribute
+	GLint GetAttribute(const std::string& name) const;
+
+	// Connects the uniform block name to a binding point of the uniform buffers. Does
+	// nothing if the program doesn't use the block.
+	void BindUniformBlock(const std::string& name, GLuint binding) const;
+
+	GLuint GetId() const;
+
+private:
+	GLuint m_id;
+	std::unordered_map<std::string, std::vector<GLint>> m_uniforms;
+	std::unordered_map<std::string, GLint> m_attributes;
+
+	static GLuint sm_current;		// program bound by the last call to Use
+};
+
+
+// Buffer of uniforms shared by every program that binds the same block to its binding
+// point, so that values they all use are written once rather than once per program
+class UniformBuffer
+{
+public:
+	UniformBuffer();
+
+	UniformBuffer(GLsizeiptr size, GLuint binding);
+
+	UniformBuffer(const UniformBuffer& copy) = delete;
+
+	UniformBuffer(UniformBuffer&& move);
+
+	UniformBuffer& operator=(const UniformBuffer& copy) = delete;
+
+	UniformBuffer& operator=(UniformBuffer&& move);
+
+	~UniformBuffer();
+
+	// Data has to be laid out by the std140 rules of the block
+	void Write(const void* data, GLsizeiptr size, GLintptr offset = 0) const;
+
+private:
+	GLuint m_id;
+};
+
+
+inline GLuint ShaderProgram::GetId() const
+{
+	return m_id;
+}
+
+#endif // !SHADER_PROGRAM_H_INCLUDED
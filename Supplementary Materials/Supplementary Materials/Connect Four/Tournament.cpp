@@ -0,0 +1,429 @@
+// Noah Rubin
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include "AI.h"
+#include "Board.h"
+
+/*
+	Plays engine-vs-engine matches between two AI configurations, A and B, so that a
+	change to the engine can be measured for speed at equal strength. Every opening is
+	played twice with the colors swapped, and games are spread across a pool of worker
+	threads. Each engine searches its root columns serially by default so that one game
+	occupies one core; pass root=parallel in the engine options to change this.
+
+	Usage:
+		Tournament [-a OPTIONS] [-b OPTIONS] [-games N] [-random PLIES | -book FILE]
+		           [-seed S] [-threads T] [-csv FILE] [-moves FILE]
+
+	OPTIONS is a list such as "depth=7,maxdepth=9,exact=12" (see ParseOptions in AI.h).
+	Add deterministic=1 when comparing node counts between runs of parallel engines.
+	A book file contains one opening per line written as columns 1-7, e.g. "4453".
+	Random openings can be at most 40 plies long, since the game would end on the next.
+	-csv writes one row per game, -moves writes one row per engine move along with the
+	score and expected line of play the engine found. Move times are the engine's own
+	search times; merging and clearing its tables after each move is reported apart.
+*/
+
+
+namespace
+{
+	constexpr int MAX_RANDOM_PLIES = Board::WIDTH * Board::HEIGHT - 2;	// the last free cell would end the game
+	constexpr int MAX_FAILED_PICKS = 64;		// columns in a row that end the game before a walk starts over
+	constexpr int MAX_OPENING_ATTEMPTS = 1000;
+
+
+	struct Settings
+	{
+		AI::Options engines[2];
+		int games = 100;
+		int randomPlies = 4;
+		std::string bookFile;
+		unsigned int seed = 1;
+		unsigned int threads = 0;
+		std::string csvFile = "tournament.csv";
+		std::string movesFile;
+	};
+
+	struct MoveRecord
+	{
+		int ply;
+		int engine;
+		int column;
+		double milliseconds;			// searching, without the table upkeep after it
+		double tableMilliseconds;		// merging and clearing the tables once the move was found
+		unsigned long long nodes;
+		int score;
+		std::string principalVariation;
+	};
+
+	struct GameResult
+	{
+		std::string opening;
+		int blackEngine;		// 0 for A, 1 for B
+		int winnerEngine;		// -1 for a draw
+		int plies;
+		std::vector<MoveRecord> moves;
+	};
+
+
+	std::string OpeningString(const std::vector<int>& moves)
+	{
+		std::string str;
+		for (int col : moves) {
+			str += (char) ('1' + col);
+		}
+		return str;
+	}
+
+
+	bool ParseOpening(const std::string& line, std::vector<int>& moves)
+	{
+		Board board;
+		moves.clear();
+		for (char c : line) {
+			if (c == '#') {
+				break;
+			}
+			if (c < '1' || c > '7') {
+				continue;
+			}
+			int col = c - '1';
+			if (board.IsColumnFull(col) || board.GetWinner() != CHIP_NONE) {
+				return false;
+			}
+			board.Drop(col);
+			moves.push_back(col);
+		}
+		return board.GetWinner() == CHIP_NONE && !board.IsBoardFull();
+	}
+
+
+	// Random walk from the empty board that avoids ending the game. A walk that keeps
+	// picking columns that can't be played has probably reached a dead end, so it starts
+	// over from the empty board. Returns false if no walk got to plies moves.
+	bool RandomOpening(std::mt19937& rng, int plies, std::vector<int>& moves)
+	{
+		for (int attempt = 0; attempt < MAX_OPENING_ATTEMPTS; ++attempt) {
+			moves.clear();
+			Board board;
+			int failedPicks = 0;
+			while ((int) moves.size() < plies && failedPicks < MAX_FAILED_PICKS) {
+				int col = rng() % Board::WIDTH;
+				Board child(board);
+				bool playable = !board.IsColumnFull(col);
+				if (playable) {
+					child.Drop(col);
+					playable = child.GetWinner() == CHIP_NONE && !child.IsBoardFull();
+				}
+				if (!playable) {
+					++failedPicks;
+					continue;
+				}
+				board = child;
+				moves.push_back(col);
+				failedPicks = 0;
+			}
+			if ((int) moves.size() == plies) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	std::vector<std::vector<int>> LoadOpenings(const Settings& settings)
+	{
+		std::vector<std::vector<int>> openings;
+		int needed = (settings.games + 1) / 2;
+		if (!settings.bookFile.empty()) {
+			std::ifstream book(settings.bookFile);
+			std::string line;
+			std::vector<int> moves;
+			while (std::getline(book, line)) {
+				if (ParseOpening(line, moves) && !moves.empty()) {
+					openings.push_back(moves);
+				}
+			}
+			if (openings.empty()) {
+				std::cerr << "No usable openings in " << settings.bookFile << "\n";
+				return openings;
+			}
+			// cycle through the book if more games are requested than it holds
+			for (int i = 0; (int) openings.size() < needed; ++i) {
+				openings.push_back(openings[i]);
+			}
+			openings.resize(needed);
+		}
+		else {
+			std::mt19937 rng(settings.seed);
+			std::vector<int> moves;
+			for (int i = 0; i < needed; ++i) {
+				if (!RandomOpening(rng, settings.randomPlies, moves)) {
+					std::cerr << "Could not generate a random opening of " << settings.randomPlies << " plies\n";
+					openings.clear();
+					return openings;
+				}
+				openings.push_back(moves);
+			}
+		}
+		return openings;
+	}
+
+
+	GameResult PlayGame(const Settings& settings, const std::vector<int>& opening, int blackEngine)
+	{
+		GameResult result;
+		result.opening = OpeningString(opening);
+		result.blackEngine = blackEngine;
+		result.winnerEngine = -1;
+
+		AI engineA(settings.engines[0]);
+		AI engineB(settings.engines[1]);
+		AI* engines[2] = { &engineA, &engineB };
+		Board board;
+		for (int col : opening) {
+			board.Drop(col);
+		}
+		int ply = (int) opening.size();
+		while (board.GetWinner() == CHIP_NONE && !board.IsBoardFull()) {
+			int engine = (board.GetThisTurn() == CHIP_BLACK ? blackEngine : blackEngine ^ 1);
+			AI::SearchResult search = engines[engine]->Search(board);
+			const AI::Statistics& statistics = engines[engine]->GetStatistics();
+			int col = search.column;
+			board.Drop(col);
+			MoveRecord record;
+			record.ply = ply++;
+			record.engine = engine;
+			record.column = col;
+			record.milliseconds = statistics.seconds * 1000.0;
+			record.tableMilliseconds = statistics.tableSeconds * 1000.0;
+			record.nodes = statistics.nodes;
+			record.score = search.score;
+			record.principalVariation = OpeningString(search.principalVariation);
+			result.moves.push_back(record);
+		}
+		if (board.GetWinner() != CHIP_NONE) {
+			result.winnerEngine = (board.GetWinner() == CHIP_BLACK ? blackEngine : blackEngine ^ 1);
+		}
+		result.plies = ply;
+		return result;
+	}
+
+
+	double Percentile(const std::vector<double>& sorted, double p)
+	{
+		if (sorted.empty()) {
+			return 0.0;
+		}
+		std::size_t rank = (std::size_t) (p / 100.0 * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(rank, sorted.size() - 1)];
+	}
+
+
+	const char* ResultString(const GameResult& game, int engine)
+	{
+		if (game.winnerEngine == -1) {
+			return "draw";
+		}
+		return game.winnerEngine == engine ? "win" : "loss";
+	}
+
+
+	void WriteGames(const std::string& file, const std::vector<GameResult>& games)
+	{
+		std::ofstream out(file);
+		out << "game,opening,a_color,a_result,plies";
+		for (const char* name : { "a", "b" }) {
+			out << "," << name << "_moves," << name << "_nodes," << name << "_ms," << name << "_max_ms";
+		}
+		out << "\n";
+		for (std::size_t i = 0; i < games.size(); ++i) {
+			const GameResult& game = games[i];
+			out << i << "," << game.opening << "," << (game.blackEngine == 0 ? "black" : "red") << ","
+				<< ResultString(game, 0) << "," << game.plies;
+			for (int engine = 0; engine < 2; ++engine) {
+				int moves = 0;
+				unsigned long long nodes = 0;
+				double total = 0.0;
+				double longest = 0.0;
+				for (const MoveRecord& move : game.moves) {
+					if (move.engine == engine) {
+						++moves;
+						nodes += move.nodes;
+						total += move.milliseconds;
+						longest = std::max(longest, move.milliseconds);
+					}
+				}
+				out << "," << moves << "," << nodes << "," << total << "," << longest;
+			}
+			out << "\n";
+		}
+	}
+
+
+	void WriteMoves(const std::string& file, const std::vector<GameResult>& games)
+	{
+		std::ofstream out(file);
+		out << "game,ply,engine,column,ms,table_ms,nodes,score,pv\n";
+		for (std::size_t i = 0; i < games.size(); ++i) {
+			for (const MoveRecord& move : games[i].moves) {
+				out << i << "," << move.ply << "," << (move.engine == 0 ? "a" : "b") << ","
+					<< move.column + 1 << "," << move.milliseconds << "," << move.tableMilliseconds << "," << move.nodes << ","
+					<< move.score << "," << move.principalVariation << "\n";
+			}
+		}
+	}
+
+
+	void PrintSummary(const std::vector<GameResult>& games, double wallSeconds)
+	{
+		int wins = 0;
+		int draws = 0;
+		int losses = 0;
+		for (const GameResult& game : games) {
+			if (game.winnerEngine == 0) {
+				++wins;
+			}
+			else if (game.winnerEngine == 1) {
+				++losses;
+			}
+			else {
+				++draws;
+			}
+		}
+		std::cout << "games " << games.size() << " in " << wallSeconds << " s\n";
+		std::cout << "A vs B: +" << wins << " =" << draws << " -" << losses << "\n";
+		for (int engine = 0; engine < 2; ++engine) {
+			std::vector<double> latencies;
+			unsigned long long nodes = 0;
+			double seconds = 0.0;
+			double tableMilliseconds = 0.0;
+			for (const GameResult& game : games) {
+				for (const MoveRecord& move : game.moves) {
+					if (move.engine == engine) {
+						latencies.push_back(move.milliseconds);
+						nodes += move.nodes;
+						seconds += move.milliseconds / 1000.0;
+						tableMilliseconds += move.tableMilliseconds;
+					}
+				}
+			}
+			std::sort(latencies.begin(), latencies.end());
+			std::cout << (engine == 0 ? "A" : "B") << ": moves " << latencies.size()
+				<< "  p50 " << Percentile(latencies, 50.0) << " ms"
+				<< "  p90 " << Percentile(latencies, 90.0) << " ms"
+				<< "  p99 " << Percentile(latencies, 99.0) << " ms"
+				<< "  max " << (latencies.empty() ? 0.0 : latencies.back()) << " ms"
+				<< "  nodes " << nodes
+				<< "  nps " << (seconds > 0.0 ? (unsigned long long) (nodes / seconds) : 0ULL)
+				<< "  tables " << tableMilliseconds << " ms\n";
+		}
+	}
+
+
+	bool ParseArguments(int argc, char** argv, Settings& settings)
+	{
+		for (AI::Options& options : settings.engines) {
+			options.parallelRoot = false;
+			options.verbose = false;
+		}
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (i + 1 >= argc) {
+				return false;
+			}
+			std::string value = argv[++i];
+			if (arg == "-a" || arg == "-b") {
+				if (!ParseOptions(value, settings.engines[arg == "-a" ? 0 : 1])) {
+					std::cerr << "Invalid engine options: " << value << "\n";
+					return false;
+				}
+			}
+			else if (arg == "-games") {
+				settings.games = std::atoi(value.c_str());
+			}
+			else if (arg == "-random") {
+				settings.randomPlies = std::atoi(value.c_str());
+			}
+			else if (arg == "-book") {
+				settings.bookFile = value;
+			}
+			else if (arg == "-seed") {
+				settings.seed = (unsigned int) std::atoi(value.c_str());
+			}
+			else if (arg == "-threads") {
+				settings.threads = (unsigned int) std::atoi(value.c_str());
+			}
+			else if (arg == "-csv") {
+				settings.csvFile = value;
+			}
+			else if (arg == "-moves") {
+				settings.movesFile = value;
+			}
+			else {
+				return false;
+			}
+		}
+		return settings.games > 0 && settings.randomPlies >= 0 && settings.randomPlies <= MAX_RANDOM_PLIES;
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!ParseArguments(argc, argv, settings)) {
+		std::cerr << "Usage: Tournament [-a OPTIONS] [-b OPTIONS] [-games N] [-random PLIES | -book FILE] "
+			"[-seed S] [-threads T] [-csv FILE] [-moves FILE]\n";
+		return 1;
+	}
+	std::vector<std::vector<int>> openings = LoadOpenings(settings);
+	if (openings.empty()) {
+		return 1;
+	}
+
+	unsigned int numThreads = settings.threads;
+	if (numThreads == 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	std::vector<GameResult> games(settings.games);
+	std::atomic<int> nextGame(0);
+	std::mutex printMutex;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < numThreads; ++t) {
+		workers.emplace_back([&]()
+		{
+			int game;
+			while ((game = nextGame++) < settings.games) {
+				games[game] = PlayGame(settings, openings[game / 2], game % 2);
+				std::lock_guard<std::mutex> lock(printMutex);
+				std::cout << "game " << game << " " << games[game].opening << ": A " << ResultString(games[game], 0) << "\n";
+			}
+		});
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	PrintSummary(games, wallSeconds);
+	WriteGames(settings.csvFile, games);
+	if (!settings.movesFile.empty()) {
+		WriteMoves(settings.movesFile, games);
+	}
+	return 0;
+}
@@ -0,0 +1,513 @@
+// Noah Rubin
+
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <Windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+#include "SearchTrace.h"
+#include "TranspositionTable.h"
+
+/*
+	Each slot stores the two bitboards of its position, the generation it was written in
+	and the packed search result:
+
+		bits 0-20	value, signed
+		bits 21-22	bound type plus one, so that a slot in use is never zero
+		bits 23-25	best column
+		bits 26-30	remaining depth
+		bit 31		set when the result comes from an exhaustive search
+
+	Both bitboards are compacted to their 42 cells, which leaves the top 12 bits of keyHigh
+	for the generation. Clear only moves on to the next generation, and slots written in
+	an earlier one count as empty, so finishing a move doesn't have to touch the whole
+	table. The memory is only zeroed when it is allocated and when the generation wraps.
+
+	A snapshot file is a SnapshotHeader followed by the raw slots. It is rejected when
+	the format version or the engine signature chosen by the owner differ from the
+	running program, or when the checksum of the slots does not match.
+*/
+
+
+namespace
+{
+	constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	constexpr std::size_t PARALLEL_CLEAR_MIN_BYTES = 16 * 1024 * 1024;
+	constexpr unsigned int SOLVED_BIT = 1u << 31;
+	constexpr int GENERATION_SHIFT = 20;
+	constexpr unsigned int KEY_HIGH_MASK = (1u << GENERATION_SHIFT) - 1;
+	constexpr unsigned int MAX_GENERATION = (1u << (32 - GENERATION_SHIFT)) - 1;
+	constexpr std::uint32_t SNAPSHOT_VERSION = 2;
+	constexpr char SNAPSHOT_MAGIC[4] { 'C', '4', 'T', 'T' };
+
+
+	struct SnapshotHeader
+	{
+		char magic[4];
+		std::uint32_t version;
+		std::uint64_t signature;
+		std::uint64_t numBuckets;
+		std::uint32_t slotSize;
+		std::uint32_t bucketSize;
+		std::uint64_t checksum;
+		std::uint64_t generation;		// slots written in any other generation are empty
+	};
+
+
+	unsigned int Pack(const TranspositionTable::Entry& entry)
+	{
+		unsigned int depth = (unsigned int) std::min(std::max(entry.depth, 0), 31);
+		return (entry.solved ? SOLVED_BIT : 0)
+			| (depth << 26)
+			| ((unsigned int) entry.bestCol << 23)
+			| (((unsigned int) entry.type + 1) << 21)
+			| ((unsigned int) entry.value & 0x1FFFFF);
+	}
+
+
+	void Unpack(unsigned int data, TranspositionTable::Entry& entry)
+	{
+		entry.value = ((int) (data << 11)) >> 11;
+		entry.type = (TranspositionTable::BoundType) (((data >> 21) & 3) - 1);
+		entry.bestCol = (data >> 23) & 7;
+		entry.depth = (data >> 26) & 31;
+		entry.solved = (data & SOLVED_BIT) != 0;
+	}
+
+
+	// FNV-1a over 64-bit words
+	std::uint64_t Checksum(const void* data, std::size_t bytes)
+	{
+		const std::uint64_t* words = static_cast<const std::uint64_t*>(data);
+		std::uint64_t hash = 0xCBF29CE484222325ULL;
+		for (std::size_t i = 0; i < bytes / sizeof(std::uint64_t); ++i) {
+			hash ^= words[i];
+			hash *= 0x100000001B3ULL;
+		}
+		return hash;
+	}
+
+
+	// Drops the unused top bit of every row, leaving the 42 cells in the low bits
+	Board::Bitboard Compact(Board::Bitboard board)
+	{
+		return (board & 0x7FULL)
+			| ((board >> 1) & 0x3F80ULL)
+			| ((board >> 2) & 0x1FC000ULL)
+			| ((board >> 3) & 0xFE00000ULL)
+			| ((board >> 4) & 0x7F0000000ULL)
+			| ((board >> 5) & 0x3F800000000ULL);
+	}
+
+
+	void MakeKey(const Board& board, Board::Bitboard& key, unsigned int& keyHigh)
+	{
+		Board::Bitboard black = Compact(board.GetBitboard(CHIP_BLACK));
+		Board::Bitboard red = Compact(board.GetBitboard(CHIP_RED));
+		key = black | (red << 42);
+		keyHigh = (unsigned int) (red >> 22);
+	}
+
+#ifdef _WIN32
+
+	bool EnableLockMemoryPrivilege()
+	{
+		HANDLE token;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+			return false;
+		}
+		TOKEN_PRIVILEGES privileges;
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		bool enabled = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+			&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+			&& GetLastError() == ERROR_SUCCESS;
+		CloseHandle(token);
+		return enabled;
+	}
+
+#else
+
+	// Binds the region to every online NUMA node in round robin order. Called before
+	// the memory is first touched so that the policy applies to every page.
+	void InterleavePages(void* memory, std::size_t bytes)
+	{
+#ifdef SYS_mbind
+		static constexpr int MPOL_INTERLEAVE_MODE = 3;
+		std::ifstream online("/sys/devices/system/node/online");
+		std::string ranges;
+		if (!std::getline(online, ranges)) {
+			return;
+		}
+		unsigned long nodeMask = 0;
+		std::istringstream stream(ranges);
+		std::string range;
+		while (std::getline(stream, range, ',')) {
+			int first = 0;
+			int last = 0;
+			char dash;
+			std::istringstream rangeStream(range);
+			rangeStream >> first;
+			last = (rangeStream >> dash >> last) ? last : first;
+			for (int node = first; node <= last && node < 64; ++node) {
+				nodeMask |= 1UL << node;
+			}
+		}
+		if (nodeMask & (nodeMask - 1)) {	// more than one node
+			syscall(SYS_mbind, memory, bytes, MPOL_INTERLEAVE_MODE, &nodeMask, 64, 0);
+		}
+#endif
+	}
+
+
+	// Transparent huge pages are granted silently, so ask the kernel how much of the
+	// region actually ended up on them.
+	bool RegionHasHugePages(const void* memory)
+	{
+		std::ifstream maps("/proc/self/smaps");
+		std::string line;
+		bool inRegion = false;
+		unsigned long start = (unsigned long) memory;
+		while (std::getline(maps, line)) {
+			unsigned long low;
+			unsigned long high;
+			char dash;
+			std::istringstream stream(line);
+			if (line.find(':') > line.find(' ') && stream >> std::hex >> low >> dash >> high) {
+				inRegion = (start >= low && start < high);
+			}
+			else if (inRegion && line.compare(0, 14, "AnonHugePages:") == 0) {
+				std::istringstream value(line.substr(14));
+				unsigned long kilobytes = 0;
+				value >> kilobytes;
+				return kilobytes > 0;
+			}
+		}
+		return false;
+	}
+
+#endif
+}
+
+
+TranspositionTable::Options::Options() :
+	sizeMB(64),
+	pages(PagePolicy::ADVISE_HUGE),
+	numa(NumaPolicy::NONE),
+	initThreads(0)
+{
+}
+
+
+TranspositionTable::TranspositionTable(const Options& options) :
+	m_options(options),
+	m_slots(nullptr),
+	m_numBuckets(0),
+	m_bytes(0),
+	m_mapped(false),
+	m_hugePages(false),
+	m_generation(0),
+	m_locks()
+{
+	Allocate();
+#ifndef _WIN32
+	if (m_options.pages != PagePolicy::NORMAL && !m_hugePages) {
+		m_hugePages = RegionHasHugePages(m_slots);
+	}
+#endif
+}
+
+
+TranspositionTable::~TranspositionTable()
+{
+	Free();
+}
+
+
+void TranspositionTable::Allocate()
+{
+	// round down to a power of two number of buckets so the index is a mask
+	std::size_t requested = std::max<std::size_t>(m_options.sizeMB, 1) * 1024 * 1024;
+	m_numBuckets = 1;
+	while (m_numBuckets * 2 * BUCKET_SIZE * sizeof(Slot) <= requested) {
+		m_numBuckets *= 2;
+	}
+	m_bytes = m_numBuckets * BUCKET_SIZE * sizeof(Slot);
+	void* memory = nullptr;
+
+#ifdef _WIN32
+	if (m_options.pages == PagePolicy::RESERVE_HUGE && EnableLockMemoryPrivilege()) {
+		std::size_t largePage = GetLargePageMinimum();
+		if (largePage && m_bytes % largePage == 0) {
+			memory = VirtualAlloc(nullptr, m_bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			m_hugePages = (memory != nullptr);
+		}
+	}
+	if (!memory) {
+		memory = VirtualAlloc(nullptr, m_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	m_mapped = (memory != nullptr);
+#else
+	if (m_options.pages == PagePolicy::RESERVE_HUGE && m_bytes % HUGE_PAGE_SIZE == 0) {
+		memory = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (memory == MAP_FAILED) {
+			memory = nullptr;
+		}
+		m_hugePages = (memory != nullptr);
+	}
+	if (!memory) {
+		memory = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			memory = nullptr;
+		}
+		else if (m_options.pages != PagePolicy::NORMAL) {
+			madvise(memory, m_bytes, MADV_HUGEPAGE);
+		}
+	}
+	m_mapped = (memory != nullptr);
+	if (memory && m_options.numa == NumaPolicy::INTERLEAVE) {
+		InterleavePages(memory, m_bytes);
+	}
+#endif
+
+	if (!memory) {
+		memory = ::operator new(m_bytes);
+	}
+	m_slots = static_cast<Slot*>(memory);
+	Wipe();
+}
+
+
+void TranspositionTable::Free()
+{
+	if (!m_slots) {
+		return;
+	}
+	if (m_mapped) {
+#ifdef _WIN32
+		VirtualFree(m_slots, 0, MEM_RELEASE);
+#else
+		munmap(m_slots, m_bytes);
+#endif
+	}
+	else {
+		::operator delete(m_slots);
+	}
+	m_slots = nullptr;
+}
+
+
+void TranspositionTable::Clear()
+{
+	if (m_generation == MAX_GENERATION) {
+		Wipe();
+		m_generation = 0;
+	}
+	else {
+		++m_generation;
+	}
+}
+
+
+void TranspositionTable::Wipe()
+{
+	unsigned int numThreads = m_options.initThreads;
+	if (numThreads == 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	if (m_bytes < PARALLEL_CLEAR_MIN_BYTES && m_options.numa != NumaPolicy::FIRST_TOUCH) {
+		numThreads = 1;
+	}
+	char* bytes = reinterpret_cast<char*>(m_slots);
+	if (numThreads == 1) {
+		std::memset(bytes, 0, m_bytes);
+		return;
+	}
+	// Each thread zeroes its own slice. On first use this is also the first touch, so
+	// under the default Linux and Windows policies every slice is placed on the node of
+	// the thread that cleared it and the table ends up spread across the machine.
+	std::size_t slice = (m_bytes / numThreads + 4095) & ~std::size_t(4095);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < numThreads && i * slice < m_bytes; ++i) {
+		std::size_t offset = i * slice;
+		std::size_t length = std::min(slice, m_bytes - offset);
+		threads.emplace_back([=]()
+		{
+			std::memset(bytes + offset, 0, length);
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+
+bool TranspositionTable::IsCurrent(const Slot& slot) const
+{
+	return slot.data && (slot.keyHigh >> GENERATION_SHIFT) == m_generation;
+}
+
+
+std::size_t TranspositionTable::BucketIndex(Board::Bitboard key, unsigned int keyHigh) const
+{
+	Board::Bitboard hash = (key ^ (keyHigh * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+	return (std::size_t) ((hash ^ (hash >> 29)) & (m_numBuckets - 1));
+}
+
+
+bool TranspositionTable::Probe(const Board& board, Entry& entry)
+{
+	Board::Bitboard key;
+	unsigned int keyHigh;
+	MakeKey(board, key, keyHigh);
+	std::size_t bucket = BucketIndex(key, keyHigh);
+	const Slot* slots = m_slots + bucket * BUCKET_SIZE;
+	unsigned int tagged = keyHigh | (m_generation << GENERATION_SHIFT);
+	SEARCH_TRACE_LOCK(lock, m_locks[bucket % NUM_LOCKS], (int) (bucket % NUM_LOCKS));
+	for (int i = 0; i < BUCKET_SIZE; ++i) {
+		if (slots[i].data && slots[i].key == key && slots[i].keyHigh == tagged) {
+			Unpack(slots[i].data, entry);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void TranspositionTable::Store(const Board& board, const Entry& entry)
+{
+	Board::Bitboard key;
+	unsigned int keyHigh;
+	MakeKey(board, key, keyHigh);
+	std::size_t bucket = BucketIndex(key, keyHigh);
+	SEARCH_TRACE_LOCK(lock, m_locks[bucket % NUM_LOCKS], (int) (bucket % NUM_LOCKS));
+	Insert(m_slots + bucket * BUCKET_SIZE, key, keyHigh, Pack(entry));
+}
+
+
+void TranspositionTable::Insert(Slot* slots, Board::Bitboard key, unsigned int keyHigh, unsigned int data)
+{
+	// same position first, then an empty or stale slot, then the shallowest result
+	unsigned int tagged = keyHigh | (m_generation << GENERATION_SHIFT);
+	auto worth = [this](const Slot& slot)
+	{
+		return IsCurrent(slot) ? (int) ((slot.data >> 26) & 31) : -1;
+	};
+	Slot* replace = slots;
+	for (int i = 0; i < BUCKET_SIZE; ++i) {
+		Slot& slot = slots[i];
+		if (slot.data && slot.key == key && slot.keyHigh == tagged) {
+			replace = &slot;
+			break;
+		}
+		if (worth(slot) < worth(*replace)) {
+			replace = &slot;
+		}
+	}
+	replace->key = key;
+	replace->keyHigh = tagged;
+	replace->data = data;
+}
+
+
+void TranspositionTable::Merge(const TranspositionTable& other)
+{
+	for (std::size_t i = 0; i < other.m_numBuckets * BUCKET_SIZE; ++i) {
+		const Slot& slot = other.m_slots[i];
+		if (other.IsCurrent(slot)) {
+			unsigned int keyHigh = slot.keyHigh & KEY_HIGH_MASK;
+			std::size_t bucket = BucketIndex(slot.key, keyHigh);
+			std::lock_guard<std::mutex> lock(m_locks[bucket % NUM_LOCKS]);
+			Insert(m_slots + bucket * BUCKET_SIZE, slot.key, keyHigh, slot.data);
+		}
+	}
+}
+
+
+bool TranspositionTable::Save(const std::string& path, unsigned long long signature) const
+{
+	SnapshotHeader header;
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.signature = signature;
+	header.numBuckets = m_numBuckets;
+	header.slotSize = sizeof(Slot);
+	header.bucketSize = BUCKET_SIZE;
+	header.checksum = Checksum(m_slots, m_bytes);
+	header.generation = m_generation;
+
+	// write to a temporary file first so that an interrupted save never replaces a good snapshot,
+	// and replace the old snapshot in one step so that there is always one to load
+	std::string temporary = path + ".tmp";
+	std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_slots), m_bytes);
+	file.close();
+	if (!file) {
+		std::remove(temporary.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	return MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+}
+
+
+bool TranspositionTable::Load(const std::string& path, unsigned long long signature)
+{
+	MappedFile file(path);
+	if (file.GetSize() < sizeof(SnapshotHeader)) {
+		return false;
+	}
+	SnapshotHeader header;
+	std::memcpy(&header, file.GetData(), sizeof(header));
+	std::size_t slotBytes = file.GetSize() - sizeof(header);
+	if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != SNAPSHOT_VERSION
+		|| header.signature != signature
+		|| header.slotSize != sizeof(Slot)
+		|| header.bucketSize != BUCKET_SIZE
+		|| header.numBuckets * BUCKET_SIZE * sizeof(Slot) != slotBytes
+		|| header.generation > MAX_GENERATION) {
+		return false;
+	}
+	const Slot* slots = reinterpret_cast<const Slot*>(static_cast<const char*>(file.GetData()) + sizeof(header));
+	if (Checksum(slots, slotBytes) != header.checksum) {
+		return false;
+	}
+
+	if (header.numBuckets == m_numBuckets) {
+		std::memcpy(m_slots, slots, m_bytes);
+		m_generation = (unsigned int) header.generation;
+	}
+	else {
+		// the table was resized since the snapshot was taken, so rehash every entry
+		Clear();
+		for (std::size_t i = 0; i < slotBytes / sizeof(Slot); ++i) {
+			const Slot& slot = slots[i];
+			if (slot.data && (slot.keyHigh >> GENERATION_SHIFT) == header.generation) {
+				unsigned int keyHigh = slot.keyHigh & KEY_HIGH_MASK;
+				Insert(m_slots + BucketIndex(slot.key, keyHigh) * BUCKET_SIZE, slot.key, keyHigh, slot.data);
+			}
+		}
+	}
+	return true;
+}
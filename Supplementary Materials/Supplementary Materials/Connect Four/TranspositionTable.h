@@ -0,0 +1,150 @@
+// Noah Rubin
+
+#ifndef TRANSPOSITION_TABLE_H_INCLUDED
+#define TRANSPOSITION_TABLE_H_INCLUDED
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+#include "Build.h"
+#include "Board.h"
+
+/*
+	Fixed size hash table of search results shared by all of the search threads.
+
+	The backing store is a single block of memory requested directly from the operating
+	system rather than one allocation per node, so that a large table can be placed on
+	huge pages and spread across NUMA nodes. Entries are 16 bytes and grouped into buckets
+	of four that fill one cache line. Each bucket is guarded by one of a fixed number of
+	striped locks.
+*/
+class TranspositionTable
+{
+public:
+	enum class BoundType
+	{
+		EXACT, LOWER_BOUND, UPPER_BOUND
+	};
+
+	enum class PagePolicy
+	{
+		NORMAL,			// ordinary pages
+		ADVISE_HUGE,	// ask the kernel to back the table with huge pages when it can (madvise)
+		RESERVE_HUGE	// reserve huge pages up front (MAP_HUGETLB / MEM_LARGE_PAGES), falling back to ADVISE_HUGE
+	};
+
+	enum class NumaPolicy
+	{
+		NONE,			// leave placement to the operating system
+		INTERLEAVE,		// spread pages round robin across all nodes
+		FIRST_TOUCH		// each initialization thread touches its own slice first
+	};
+
+	struct Options
+	{
+		Options();
+
+		std::size_t sizeMB;
+		PagePolicy pages;
+		NumaPolicy numa;
+		unsigned int initThreads;	// threads that zero the table when it is allocated, 0 for one per core
+	};
+
+	struct Entry
+	{
+		BoundType type;
+		int value;
+		int depth;
+		int bestCol;
+		bool solved;		// result of an exhaustive rather than a heuristic search
+	};
+
+	explicit TranspositionTable(const Options& options);
+
+	TranspositionTable(const TranspositionTable& copy) = delete;
+
+	TranspositionTable& operator=(const TranspositionTable& copy) = delete;
+
+	~TranspositionTable();
+
+	bool Probe(const Board& board, Entry& entry);
+
+	void Store(const Board& board, const Entry& entry);
+
+	// Forgets every entry without touching the memory. Must not be called while a search is
+	// running.
+	void Clear();
+
+	// Inserts every entry of other into this table in slot order, so that the result depends
+	// only on the contents of the two tables. Other must not be written to meanwhile.
+	void Merge(const TranspositionTable& other);
+
+	// Writes every entry to a snapshot file. Must not be called while a search is running.
+	bool Save(const std::string& path, unsigned long long signature) const;
+
+	// Replaces the contents of the table with a snapshot written by Save. Returns false and
+	// leaves the table untouched if the file is missing, corrupt, from another format
+	// version or was written with a different signature.
+	bool Load(const std::string& path, unsigned long long signature);
+
+	std::size_t GetSizeBytes() const;
+
+	std::size_t GetNumEntries() const;
+
+	bool HasHugePages() const;
+
+private:
+	struct Slot
+	{
+		Board::Bitboard key;
+		unsigned int keyHigh;
+		unsigned int data;
+	};
+
+	static constexpr int BUCKET_SIZE = 4;
+	static constexpr int NUM_LOCKS = 1024;
+
+	Options m_options;
+	Slot* m_slots;
+	std::size_t m_numBuckets;
+	std::size_t m_bytes;
+	bool m_mapped;
+	bool m_hugePages;
+	unsigned int m_generation;		// bumped by Clear, only slots tagged with it are in use
+	std::mutex m_locks[NUM_LOCKS];
+
+	void Allocate();
+
+	void Free();
+
+	// Zeroes every slot, in parallel on large tables
+	void Wipe();
+
+	bool IsCurrent(const Slot& slot) const;
+
+	std::size_t BucketIndex(Board::Bitboard key, unsigned int keyHigh) const;
+
+	// keyHigh without a generation, the slot is tagged with the current one
+	void Insert(Slot* slots, Board::Bitboard key, unsigned int keyHigh, unsigned int data);
+};
+
+
+inline std::size_t TranspositionTable::GetSizeBytes() const
+{
+	return m_bytes;
+}
+
+
+inline std::size_t TranspositionTable::GetNumEntries() const
+{
+	return m_numBuckets * BUCKET_SIZE;
+}
+
+
+inline bool TranspositionTable::HasHugePages() const
+{
+	return m_hugePages;
+}
+
+#endif // !TRANSPOSITION_TABLE_H_INCLUDED
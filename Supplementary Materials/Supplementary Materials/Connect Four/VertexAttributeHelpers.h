@@ -5,8 +5,13 @@
 
 #include "Mesh.h"
 
-void WriteBuffer(const VertexAttribute& attrib, GLenum type);
-
 bool IsIntegral(const VertexAttribute& attrib);
 
+// Bytes of one component of the attribute
+GLsizei GetTypeSize(GLenum type);
+
+// Enables the attribute and points it at the buffer bound to GL_ARRAY_BUFFER, with the
+// vertex array bound
+void AttachAttribute(const VertexAttribute& attrib, GLsizei stride);
+
 #endif
@@ -3,37 +3,26 @@
 #include "Mesh.h"
 #include "VertexAttributeHelpers.h"
 
-VertexMesh::VertexMesh(const std::vector<VertexAttribute>& attribs, GLenum primitive) :
-VertexMesh(attribs, primitive, attribs[0].data.size() / attribs[0].attribSize, true)
-{
-}
-
-
 VertexMesh::VertexMesh(
-	const std::vector<VertexAttribute>& attribs,
+	const void* vertices,
+	GLsizei numVertices,
+	const AttributeLayout& layout,
 	GLenum primitive,
 	GLsizei numVerts,
 	bool unbind
 	) :
-	m_attribBuffers(attribs.size()),
+	m_vertexBuffer(0),
 	m_vao(0),
 	m_primitive(primitive),
 	m_numVerts(numVerts)
 {
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
-	glGenBuffers(attribs.size(), m_attribBuffers.data());
-	for (int i = 0; i < attribs.size(); ++i) {
-		const VertexAttribute& attrib = attribs[i];
-		glBindBuffer(GL_ARRAY_BUFFER, m_attribBuffers[i]);
-		WriteBuffer(attrib, attrib.type);
-		glEnableVertexAttribArray(attrib.index);
-		if (IsIntegral(attrib)) {
-			glVertexAttribIPointer(attrib.index, attrib.attribSize, attrib.type, 0, 0);
-		}
-		else {
-			glVertexAttribPointer(attrib.index, attrib.attribSize, attrib.type, attrib.normalized, 0, 0);
-		}
+	glGenBuffers(1, &m_vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) layout.stride * numVertices, vertices, GL_STATIC_DRAW);
+	for (int i = 0; i < layout.numAttribs; ++i) {
+		AttachAttribute(layout.attribs[i], layout.stride);
 	}
 	if (unbind) {
 		glBindVertexArray(0);
@@ -42,30 +31,31 @@ VertexMesh::VertexMesh(
 
 
 VertexMesh::VertexMesh(VertexMesh&& move) :
-	m_attribBuffers(std::move(move.m_attribBuffers)),
+	m_vertexBuffer(move.m_vertexBuffer),
 	m_vao(move.m_vao),
 	m_primitive(move.m_primitive),
 	m_numVerts(move.m_numVerts)
 {
+	move.m_vertexBuffer = 0;
 	move.m_vao = 0;
 }
 
 
+// The buffers this mesh held are deleted along with move
 VertexMesh& VertexMesh::operator=(VertexMesh&& move)
 {
-	m_attribBuffers = std::move(move.m_attribBuffers);
-	m_vao = move.m_vao;
+	std::swap(m_vertexBuffer, move.m_vertexBuffer);
+	std::swap(m_vao, move.m_vao);
 	m_primitive = move.m_primitive;
 	m_numVerts = move.m_numVerts;
-	move.m_vao = 0;
 	return *this;
 }
 
 
 VertexMesh::~VertexMesh()
 {
-	if (m_attribBuffers.size()) {
-		glDeleteBuffers(m_attribBuffers.size(), m_attribBuffers.data());
+	if (m_vao) {
+		glDeleteBuffers(1, &m_vertexBuffer);
 		glDeleteVertexArrays(1, &m_vao);
 	}
 }
@@ -76,4 +66,4 @@ void VertexMesh::Render() const
 	glBindVertexArray(m_vao);
 	glDrawArrays(m_primitive, 0, m_numVerts);
 	glBindVertexArray(0);
-}
\ No newline at end of file
+}
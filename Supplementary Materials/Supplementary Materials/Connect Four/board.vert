@@ -2,9 +2,12 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 mvpMat;
+layout(std140) uniform Camera
+{
+	mat4 mvp;
+};
 
 void main()
 {
-	gl_Position = mvpMat * position;
+	gl_Position = mvp * position;
 }
\ No newline at end of file
@@ -1,15 +1,18 @@
 #version 330
 
 layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 color;
+layout(location = 2) in vec2 translation;
 
-uniform mat4 mvp;
-uniform vec4 colors[42];
-uniform vec2 translations[42];
+layout(std140) uniform Camera
+{
+	mat4 mvp;
+};
 
 flat out vec4 fragColor;
 
 void main()
 {
-	fragColor = colors[gl_InstanceID];
-	gl_Position = mvp * (position + vec4(translations[gl_InstanceID], 0.0f, 0.0f));
+	fragColor = color;
+	gl_Position = mvp * (position + vec4(translation, 0.0f, 0.0f));
 }
\ No newline at end of file
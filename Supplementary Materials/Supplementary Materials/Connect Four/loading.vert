@@ -2,7 +2,10 @@
 
 layout(location = 0) in vec4 position;
 
-uniform mat4 mvp;
+layout(std140) uniform Camera
+{
+	mat4 mvp;
+};
 uniform vec4 colors[3];
 
 flat out vec4 fragColor;
@@ -9,10 +9,13 @@
 #	endif
 #endif
 
+#include <cmath>
 #include <random>
 #include <chrono>
-#include <thread>
 #include <atomic>
+#include <memory>
+#include <thread>
+#include <future>
 #include <iostream>
 
 #include "Libraries/gl/glew.h"
@@ -22,33 +25,40 @@
 
 #include "Board.h"
 #include "ResourceLoader.h"
+#include "ShaderProgram.h"
 #include "AI.h"
 
 
 namespace
 {
-	constexpr float RADIUS_MAGIC  = 0.085f;
+	constexpr float CHIP_RADIUS = 0.5f;
+	constexpr float CHIP_DEPTH = -0.51f;		// z of the chip faces, just in front of the board
+	constexpr float FIRST_COLUMN_X = 4.5f;		// x of the centre of column 0, the others follow towards -x
+	constexpr float CHIP_SPACING = 1.5f;		// between the centres of neighbouring chips
+	constexpr double SPINNER_INTERVAL = 1.0;	// seconds between turns of the loading spinner
+	constexpr double MAX_FRAME_RATE = 60.0;		// frames per second at most, 0 for no limit
+	constexpr GLuint CAMERA_BINDING = 0;		// uniform buffer binding point of the Camera block
+	constexpr int NUM_CHIPS = Board::WIDTH * Board::HEIGHT;
+	constexpr int CHIP_COLORS = 0;				// instance attributes of the chip mesh
+	constexpr int CHIP_TRANSLATIONS = 1;
 	const glm::vec4 backgroundColor(0.25f, 0.43f, 0.5f, 1.0f);
 
 	glm::mat4 projection;
 	glm::mat4 modelView = glm::lookAt(glm::vec3(0.0f, 0.0f, -6.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	GLuint boardProgram;
-	GLuint chipProgram;
-	GLuint loadingProgram;
+	ShaderProgram boardProgram;
+	ShaderProgram chipProgram;
+	ShaderProgram loadingProgram;
+	UniformBuffer camera;						// the Camera block every program reads the mvp matrix from
+	std::unique_ptr<InstancedVertexMesh> chips;	// one instance per cell, row by row from the top
 	int hoveredColumn = -1;
 	bool gameOver = false;
 	std::atomic<bool> inputDisabled = false;
-	std::atomic<int> fillRow = -1;
-	std::atomic<int> fillCol = -1;
 	Board board;
 	AI ai;
-
-
-	template<class T>
-	bool InRange(T x, T min, T max)
-	{
-		return x >= min && x <= max;
-	}
+	AI::SearchHandle search;
+	std::thread waker;						// wakes the render loop while the AI searches
+	std::atomic<bool> spinnerTurn(false);	// set by the waker when the loading spinner is due to turn
+	bool redraw = true;						// whether anything on screen changed since the last frame
 
 
 	void Resize(GLFWwindow* win, int w, int h)
@@ -56,29 +66,33 @@ namespace
 		glViewport(0, 0, w, h);
 		projection = glm::perspective(90.0f, (float) w / h, 1.0f, 100.0f);
 		glm::mat4 mvp = projection * modelView;
-		glUniformMatrix4fv(glGetUniformLocation(boardProgram, "mvpMat"), 1, GL_FALSE, glm::value_ptr(mvp));
-		glUniformMatrix4fv(glGetUniformLocation(chipProgram, "mvp"), 1, GL_FALSE, glm::value_ptr(mvp));
-		glUniformMatrix4fv(glGetUniformLocation(loadingProgram, "mvp"), 1, GL_FALSE, glm::value_ptr(mvp));
+		camera.Write(glm::value_ptr(mvp), sizeof(mvp));
+		redraw = true;
+	}
+
+
+	void Refresh(GLFWwindow* win)
+	{
+		redraw = true;
 	}
 
 
-	void SetColorUniform(int col, int row, Chip chip)
+	void SetChipColor(int col, int row, Chip chip)
 	{
 		glm::vec4 color = (chip == CHIP_BLACK ? glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) : glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-		GLint unif = glGetUniformLocation(chipProgram, "colors") + Board::WIDTH * row + col;
-		glUseProgram(chipProgram);
-		glUniform4fv(unif, 1, glm::value_ptr(color));
+		chips->UpdateInstances(CHIP_COLORS, Board::WIDTH * row + col, 1, glm::value_ptr(color));
+		redraw = true;
 	}
 
 
 	void Startup()
 	{
-		glm::vec4 colors[42];
-		for (int i = 0; i < 42; ++i) {
+		glm::vec4 colors[NUM_CHIPS];
+		for (int i = 0; i < NUM_CHIPS; ++i) {
 			colors[i] = backgroundColor;
 		}
-		glUseProgram(chipProgram);
-		glUniform4fv(glGetUniformLocation(chipProgram, "colors"), 42, (float*) colors);
+		chips->WriteInstances(CHIP_COLORS, NUM_CHIPS, colors);
+		redraw = true;
 
 		char in = 0;
 		while (in != '0' && in != '1') {
@@ -88,7 +102,8 @@ namespace
 		if (in == '0') {
 			int col = ai.BestMove(board);
 			int row = board.Drop(col);
-			SetColorUniform(col, row, board.GetNextTurn());
+			SetChipColor(col, row, board.GetNextTurn());
+			ai.StartPondering(board);
 		}
 	}
 
@@ -104,26 +119,85 @@ namespace
 	}
 
 
+	AI::SearchOptions ProgressOptions()
+	{
+		AI::SearchOptions options;
+		options.progressInterval = 5.0;
+		options.progress = [](const AI::Progress& progress)
+		{
+			std::cout << "Searching " << progress.depth << " moves ahead, " << progress.nodes << " positions so far\n";
+		};
+		return options;
+	}
+
+
+	// The render loop sleeps until something happens, so while the AI searches it has to be
+	// woken for every turn of the loading spinner and once more when the move is ready.
+	// GLFW 3.1 has no glfwWaitEventsTimeout, so this is done by a thread of its own.
+	void StartWaker()
+	{
+		std::shared_future<AI::SearchResult> result = search.GetFuture();
+		waker = std::thread([result]()
+		{
+			while (result.wait_for(std::chrono::duration<double>(SPINNER_INTERVAL)) != std::future_status::ready) {
+				spinnerTurn = true;
+				glfwPostEmptyEvent();
+			}
+			glfwPostEmptyEvent();
+		});
+	}
+
+
+	void StopWaker()
+	{
+		if (waker.joinable()) {
+			waker.join();
+		}
+	}
+
+
+	// Plays the move of a finished search and lets the AI think on while the human does.
+	// Called from the render loop so that the board is only ever changed on the main thread.
+	void FinishSearch()
+	{
+		AI::SearchResult result = search.Wait();
+		search = AI::SearchHandle();
+		StopWaker();
+		int row = board.Drop(result.column);
+		SetChipColor(result.column, row, board.GetNextTurn());
+		CheckWinner();
+		if (board.GetWinner() != CHIP_NONE || board.IsBoardFull()) {
+			inputDisabled = true;
+		}
+		else {
+			inputDisabled = false;
+			ai.StartPondering(board);
+		}
+	}
+
+
+	void StopSearch()
+	{
+		if (search.IsValid()) {
+			search.Stop();
+			search.Wait();
+			search = AI::SearchHandle();
+		}
+		StopWaker();
+		ai.StopPondering();
+	}
+
+
 	void Click(GLFWwindow* win, int button, int action, int mods)
 	{
 		if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_1 && hoveredColumn != -1 && !board.IsColumnFull(hoveredColumn) && !inputDisabled) {
 			int row = board.Drop(hoveredColumn);
-			SetColorUniform(hoveredColumn, row, board.GetNextTurn());
+			SetChipColor(hoveredColumn, row, board.GetNextTurn());
 			CheckWinner();
 			if (!board.IsBoardFull()) {
-				inputDisabled = true;				
-				std::thread([]()
-				{
-					fillCol = ai.BestMove(board);
-					fillRow = board.Drop(fillCol);
-					CheckWinner();
-					if (board.GetWinner() != CHIP_NONE || board.IsBoardFull()) {
-						inputDisabled = true;
-					}
-					else {
-						inputDisabled = false;
-					}
-				}).detach();
+				inputDisabled = true;
+				search = ai.StartSearch(board, ProgressOptions());
+				StartWaker();
 			}
 			else {
 				std::cout << "Draw\n";
@@ -132,40 +206,25 @@ namespace
 	}
 
 
+	// Casts a ray from the camera through the cursor, with no read back from the GPU, and
+	// hovers the column whose chips it passes through on the plane of their faces
 	void MouseMoved(GLFWwindow* win, double x, double y)
 	{
 		int w, h;
-		float z;
 		glfwGetWindowSize(win, &w, &h);
-		glReadPixels(x, y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &z);
-		z = 0.0f;
-		glm::vec3 pos = glm::unProject(
-			glm::vec3(x, h - y, z),
-			modelView,
-			projection,
-			glm::vec4(0.0f, 0.0f, w, h)
-			);
+		glm::vec4 viewport(0.0f, 0.0f, w, h);
+		glm::vec3 nearPoint = glm::unProject(glm::vec3(x, h - y, 0.0f), modelView, projection, viewport);
+		glm::vec3 farPoint = glm::unProject(glm::vec3(x, h - y, 1.0f), modelView, projection, viewport);
+		glm::vec3 direction = glm::normalize(farPoint - nearPoint);
+		float distance;
 		hoveredColumn = -1;
-		if (InRange(pos.x, -0.82f - RADIUS_MAGIC, -0.82f + RADIUS_MAGIC)) {
-			hoveredColumn = 6;
-		}
-		else if (InRange(pos.x, -0.55f - RADIUS_MAGIC, -0.55f + RADIUS_MAGIC)) {
-			hoveredColumn = 5;
-		}
-		else if (InRange(pos.x, -0.28f - RADIUS_MAGIC, -0.28f + RADIUS_MAGIC)) {
-			hoveredColumn = 4;
+		if (!glm::intersectRayPlane(nearPoint, direction, glm::vec3(0.0f, 0.0f, CHIP_DEPTH), glm::vec3(0.0f, 0.0f, -1.0f), distance)) {
+			return;
 		}
-		else if (InRange(pos.x, -0.01f - RADIUS_MAGIC, -0.01f + RADIUS_MAGIC)) {
-			hoveredColumn = 3;
-		}
-		else if (InRange(pos.x, 0.28f - RADIUS_MAGIC, 0.28f + RADIUS_MAGIC)) {
-			hoveredColumn = 2;
-		}
-		else if (InRange(pos.x, 0.55f - RADIUS_MAGIC, 0.55f + RADIUS_MAGIC)) {
-			hoveredColumn = 1;
-		}
-		else if (InRange(pos.x, 0.82f - RADIUS_MAGIC, 0.82f + RADIUS_MAGIC)) {
-			hoveredColumn = 0;
+		float hitX = nearPoint.x + direction.x * distance;
+		int col = (int) std::floor((FIRST_COLUMN_X - hitX) / CHIP_SPACING + 0.5f);
+		if (col >= 0 && col < Board::WIDTH && std::abs(hitX - (FIRST_COLUMN_X - CHIP_SPACING * col)) <= CHIP_RADIUS) {
+			hoveredColumn = col;
 		}
 	}
 
@@ -189,25 +248,22 @@ namespace
 			return nullptr;
 		}
 		glfwSetWindowSizeCallback(win, &Resize);
+		glfwSetWindowRefreshCallback(win, &Refresh);
 		glfwSetMouseButtonCallback(win, &Click);
 		glfwSetCursorPosCallback(win, &MouseMoved);
 		return win;
 	}
 
 
-	std::vector<AttributeData> CircleVerts()
+	std::vector<PositionVertex> CircleVerts()
 	{
 		static constexpr int numTriangles = 100;
 		float increment = 2.0f * glm::pi<float>() / ((numTriangles + 2) / 3);
-		std::vector<AttributeData> verts((numTriangles + 2) * 3);
+		std::vector<PositionVertex> verts(numTriangles + 2);
 		float currentAngle = 2.0f * glm::pi<float>();
-		verts[0].fVal = 0.0f;
-		verts[1].fVal = 0.0f;
-		verts[2].fVal = -0.51f;
-		for (int i = 3; i < verts.size() - 1; i += 3) {
-			verts[i].fVal = 0.5f * std::cos(currentAngle);
-			verts[i + 1].fVal = 0.5f * std::sin(currentAngle);
-			verts[i + 2].fVal = -0.51f;
+		verts[0] = PositionVertex { 0.0f, 0.0f, -0.51f };
+		for (std::size_t i = 1; i < verts.size(); ++i) {
+			verts[i] = PositionVertex { 0.5f * std::cos(currentAngle), 0.5f * std::sin(currentAngle), -0.51f };
 			currentAngle -= increment;
 		}
 		return verts;
@@ -219,12 +275,12 @@ namespace
 		std::getchar();
 		int col = ai.BestMove(board);
 		int row = board.Drop(col);
-		SetColorUniform(col, row, board.GetNextTurn());
+		SetChipColor(col, row, board.GetNextTurn());
 		CheckWinner();
 		if (!board.IsBoardFull()) {
 			col = ai.BestMove(board);
 			row = board.Drop(col);
-			SetColorUniform(col, row, board.GetNextTurn());
+			SetChipColor(col, row, board.GetNextTurn());
 			CheckWinner();
 		}
 		else {
@@ -248,89 +304,74 @@ namespace
 		GLuint chipVertShader = LoadShaderFile("chip.vert", GL_VERTEX_SHADER);
 		GLuint chipFragShader = LoadShaderFile("chip.frag", GL_FRAGMENT_SHADER);
 		GLuint loadingVertShader = LoadShaderFile("loading.vert", GL_VERTEX_SHADER);
-		GLuint loadingFragShader = LoadShaderFile("loading.vert", GL_FRAGMENT_SHADER);
+		GLuint loadingFragShader = LoadShaderFile("loading.frag", GL_FRAGMENT_SHADER);
 #endif
-		boardProgram = LinkShaders(boardVertShader, boardFragShader);
-		chipProgram = LinkShaders(chipVertShader, chipFragShader);
-		loadingProgram = LinkShaders(loadingVertShader, loadingFragShader);
-		glUseProgram(boardProgram);
-		Resize(win, 600, 400);
-		glUseProgram(chipProgram);
-		Resize(win, 600, 400);
-		glUseProgram(loadingProgram);
+		boardProgram = ShaderProgram(LinkShaders(boardVertShader, boardFragShader));
+		chipProgram = ShaderProgram(LinkShaders(chipVertShader, chipFragShader));
+		loadingProgram = ShaderProgram(LinkShaders(loadingVertShader, loadingFragShader));
+		boardProgram.BindUniformBlock("Camera", CAMERA_BINDING);
+		chipProgram.BindUniformBlock("Camera", CAMERA_BINDING);
+		loadingProgram.BindUniformBlock("Camera", CAMERA_BINDING);
+		camera = UniformBuffer(sizeof(glm::mat4), CAMERA_BINDING);
 		Resize(win, 600, 400);
 	}
 
 
 	InstancedVertexMesh CreateCircleMesh()
 	{
-		std::vector<AttributeData> verts = CircleVerts();
-		VertexAttribute attribs(verts, 0, 3, GL_FLOAT);
-		return InstancedVertexMesh({ attribs }, GL_TRIANGLE_FAN, 42);
+		std::vector<VertexAttribute> instanceAttribs { MakeVertexAttribute<GLfloat[4]>(1), MakeVertexAttribute<GLfloat[2]>(2) };
+		return InstancedVertexMesh(CircleVerts(), VertexLayout<PositionVertex>(POSITION_VERTEX_ATTRIBS), instanceAttribs, GL_TRIANGLE_FAN, NUM_CHIPS);
 	}
 
 	VertexMesh CreateLoadingMesh()
 	{		
 		static constexpr int numTriangles = 100;
 		float increment = 2.0f * glm::pi<float>() / ((numTriangles + 2) / 3);
-		std::vector<AttributeData> verts(numTriangles * 9);
+		std::vector<PositionVertex> verts(numTriangles * 3);
 		float currentAngle = 2.0f * glm::pi<float>();
-		for (int i = 0; i < verts.size(); i += 9) {
-			verts[i].fVal = 0.0f;
-			verts[i + 1].fVal = 0.0f;
-			verts[i + 2].fVal = -0.51f;
-
-			verts[i + 3].fVal = 0.5f * std::cos(currentAngle);
-			verts[i + 4].fVal = 0.5f * std::sin(currentAngle);
-			verts[i + 5].fVal = -0.51f;
+		for (std::size_t i = 0; i < verts.size(); i += 3) {
+			verts[i] = PositionVertex { 0.0f, 0.0f, -0.51f };
+
+			verts[i + 1] = PositionVertex { 0.5f * std::cos(currentAngle), 0.5f * std::sin(currentAngle), -0.51f };
 			currentAngle -= increment;
 
-			verts[i + 6].fVal = 0.5f * std::cos(currentAngle);
-			verts[i + 7].fVal = 0.5f * std::sin(currentAngle);
-			verts[i + 8].fVal = -0.51f;
+			verts[i + 2] = PositionVertex { 0.5f * std::cos(currentAngle), 0.5f * std::sin(currentAngle), -0.51f };
 
 			currentAngle -= increment;
 		}
 
-		int size = verts.size();
-
-		VertexAttribute attribs(verts, 0, 3, GL_FLOAT);
-		return VertexMesh({ attribs }, GL_TRIANGLES);
+		return VertexMesh(verts, VertexLayout<PositionVertex>(POSITION_VERTEX_ATTRIBS), GL_TRIANGLES);
 	}
 
 
 	IndexedMesh CreateBoardMesh()
 	{
-		GLfloat boardVerts[]{
-			-5.5f, 4.75f, -0.5f,	// top left
-			5.5f, 4.75f, -0.5f,		// top right
-			-5.5f, -4.75f, -0.5f,	// bottom left
-			5.5f, -4.75f, -0.5f		// bottom right
+		std::vector<PositionVertex> boardVerts {
+			{ -5.5f, 4.75f, -0.5f },	// top left
+			{ 5.5f, 4.75f, -0.5f },		// top right
+			{ -5.5f, -4.75f, -0.5f },	// bottom left
+			{ 5.5f, -4.75f, -0.5f }		// bottom right
 		};
 		std::vector<GLushort> boardIndices{
 			0, 1, 2,
 			2, 1, 3
 		};
-		std::vector<VertexAttribute> boardAttribs{ VertexAttribute(0, 3, GL_FLOAT) };
-		boardAttribs[0].AddData(boardVerts, 12);
-		return IndexedMesh(boardAttribs, boardIndices, GL_TRIANGLES);
+		return IndexedMesh(boardVerts, VertexLayout<PositionVertex>(POSITION_VERTEX_ATTRIBS), boardIndices, GL_TRIANGLES);
 	}
 
 	void RotateLoadingColors()
 	{
-		static double lastTime = -1.0;
 		static glm::vec4 colors[] {
 			colors[0] = glm::vec4{ 0.6f, 0.6f, 0.6f , 1.0f },
 			colors[1] = glm::vec4{ 0.75f, 0.75f, 0.75f , 1.0f },
 			colors[2] = glm::vec4{ 0.9f, 0.9f, 0.9f , 1.0f },
 		};
 
-		if (glfwGetTime() - lastTime > 1.0) {
-			glUniform4fv(glGetUniformLocation(loadingProgram, "colors"), 3, (float*) colors);
-			std::swap(colors[0], colors[1]);
-			std::swap(colors[0], colors[2]);
-			lastTime = glfwGetTime();
-		}
+		loadingProgram.Use();
+		glUniform4fv(loadingProgram.GetUniform("colors"), 3, (float*) colors);
+		std::swap(colors[0], colors[1]);
+		std::swap(colors[0], colors[2]);
+		redraw = true;
 	}
 }
 
@@ -347,64 +388,83 @@ int main()
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
 	glFrontFace(GL_CCW);
+	glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, backgroundColor.a);
+	glClearDepth(1.0f);
 
 	glGetError();
 
 	LoadShaders(win);
 
-	glm::vec2 translations[42];
-	for (int i = 0; i < 42; ++i) {
+	chips.reset(new InstancedVertexMesh(CreateCircleMesh()));
+	glm::vec2 translations[NUM_CHIPS];
+	for (int i = 0; i < NUM_CHIPS; ++i) {
 		int row = i / Board::WIDTH;
 		int col = i % Board::WIDTH;
-		translations[i].x = 4.5f - 1.5f * col;
-		translations[i].y = 3.75f - 1.5f * row;
+		translations[i].x = FIRST_COLUMN_X - CHIP_SPACING * col;
+		translations[i].y = 3.75f - CHIP_SPACING * row;
 	}
 
-	glUseProgram(chipProgram);
-	glUniform2fv(glGetUniformLocation(chipProgram, "translations"), 42, (float*) translations);
+	chips->WriteInstances(CHIP_TRANSLATIONS, NUM_CHIPS, translations);
+	RotateLoadingColors();
 
 	Startup();
 
 	IndexedMesh boardMesh = CreateBoardMesh();
-	InstancedVertexMesh circleMesh = CreateCircleMesh();
 	VertexMesh loadingMesh = CreateLoadingMesh();
+	// Frames are only drawn when something changed: a chip was dropped, the window was
+	// resized or uncovered, or the spinner turned. In between the loop sleeps in
+	// glfwWaitEvents, which leaves every core to the search.
+	double lastFrame = -1.0;
 	while (!glfwWindowShouldClose(win)) {
-		if (fillCol != -1) {
-			SetColorUniform(fillCol, fillRow, board.GetNextTurn());
-			fillCol = -1;
-			fillRow = -1;
+		if (search.IsReady()) {
+			FinishSearch();
 		}
-		glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, backgroundColor.a);
-		glClearDepth(1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glUseProgram(boardProgram);
-		boardMesh.Render();
-		glUseProgram(chipProgram);
-		circleMesh.Render();
-		if (inputDisabled) {
-			glUseProgram(loadingProgram);
+		if (spinnerTurn.exchange(false) && inputDisabled) {
 			RotateLoadingColors();
-			loadingMesh.Render();
 		}
+		if (board.GetWinner() != CHIP_NONE || board.IsBoardFull()) {
+			gameOver = true;
+			inputDisabled = true;
+		}
+		if (redraw) {
+			double wait = (MAX_FRAME_RATE > 0.0 ? lastFrame + 1.0 / MAX_FRAME_RATE - glfwGetTime() : 0.0);
+			if (wait > 0.0) {
+				std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+			}
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			boardProgram.Use();
+			boardMesh.Render();
+			chipProgram.Use();
+			chips->Render();
+			if (inputDisabled) {
+				loadingProgram.Use();
+				loadingMesh.Render();
+			}
 
-		glfwSwapBuffers(win);
-		glfwPollEvents();
+			glfwSwapBuffers(win);
+			lastFrame = glfwGetTime();
+			redraw = false;
+		}
 		if (gameOver) {
+			glfwPollEvents();
 			std::getchar();
+			StopSearch();
 			board = Board();
 			ai.Reset();
 			Startup();
 			gameOver = false;
 			inputDisabled = false;
 		}
-		if (board.GetWinner() != CHIP_NONE || board.IsBoardFull()) {
-			gameOver = true;
-			inputDisabled = true;
+		else {
+			glfwWaitEvents();
 		}
 	}
-	glUseProgram(0);
-	glDeleteProgram(boardProgram);
-	glDeleteProgram(chipProgram);
+	StopSearch();
+	chips.reset();
+	boardProgram = ShaderProgram();
+	chipProgram = ShaderProgram();
+	loadingProgram = ShaderProgram();
+	camera = UniformBuffer();
 	glfwDestroyWindow(win);
 	glfwTerminate();
 	return 0;